@@ -11,7 +11,7 @@
 #include <lifo.h>
 
 #include <stdint.h>
-#include <stdlib.h> /* calloc(); free() */
+#include <stdlib.h> /* calloc(); free(); posix_memalign() */
 
 #include <ffec_matrix.h>
 
@@ -27,13 +27,26 @@ Minimum number of 1s per matrix column.
 #endif
 
 /*	Alignment!
-Symbols must be a multiple of this size.
-	(see ffec_xor.c: we are using YMM registers if possible or at least an unrolled loop)
-Given in Bytes.
+Symbols may be of any length, but a multiple of this size is processed
+	entirely in SIMD registers (see ffec_xor_tmpl.h);
+	any other length has a tail of up to this many Bytes
+	which is processed one word at a time.
+Given in Bytes: the widest supported vector (AVX-512).
 */
-#define FFEC_SYM_ALIGN 256
-#if (FFEC_SYM_ALIGN != 256)
-	#error "XOR loop is hand-unrolled. Only 256B alignment supported at this time."
+#define FFEC_SYM_ALIGN 64
+
+/*	Memory alignment
+Symbol regions allocated by ffec are aligned to (at least) this many Bytes:
+	a cache line, and the alignment required by streaming stores
+	and aligned vector loads.
+May be raised to the page size (4096) at build time, e.g. for O_DIRECT;
+	must be a power of 2 and no smaller than FFEC_SYM_ALIGN.
+*/
+#ifndef FFEC_MEM_ALIGN
+	#define FFEC_MEM_ALIGN 64
+#endif
+#if (FFEC_MEM_ALIGN < FFEC_SYM_ALIGN) || (FFEC_MEM_ALIGN & (FFEC_MEM_ALIGN -1))
+	#error "FFEC_MEM_ALIGN must be a power of 2, no smaller than FFEC_SYM_ALIGN"
 #endif
 
 /* Minimum number of symbols for proper operation
@@ -71,7 +84,75 @@ struct ffec_params {
 	double		fec_ratio;	/* MUST be >1.0, SHOULD be <1.3,
 						although it can be higher.
 					*/
-	uint32_t	sym_len;	/* Must be multiple of FFEC_SYM_ALIGN */
+	uint32_t	sym_len;	/* Any; ideally multiple of FFEC_SYM_ALIGN */
+	uint32_t	window;		/* 0: a source symbol may be in any rows.
+					Otherwise: its rows are mostly within
+						a window or two of this many rows,
+						near those of its neighbours
+						(see ffec_gen_rows_()).
+					SHOULD be >=1024 if used: narrower windows
+						sometimes decode less efficiently.
+					*/
+};
+
+/*	ffec_flags
+Per-instance options: OR them into 'fi->flags' after ffec_new().
+Unlike ffec_params, these need NOT be the same at encode and decode ends.
+*/
+enum ffec_flags {
+	FFEC_NT_STORE	= 0x1,	/* Write symbols which are final (decoded symbols,
+					encoded parity) with non-temporal (streaming) stores,
+					so that they don't evict the working set
+					(psums, matrix) from cache.
+				Helps with large blocks; hurts if the caller reads
+					the symbols again right away.
+				*/
+	FFEC_CRC	= 0x2,	/* Encode: compute the CRC32C of each source symbol
+					into 'fi->crc' while reading it.
+				Decode: caller copies the encoder's 'fi->crc' over;
+					each source symbol (received or recovered)
+					is checked in the same pass that stores it.
+				A received symbol which fails is rejected (undone);
+					a recovered one which fails means a corrupt
+					parity symbol was received earlier.
+				Either way ffec_decode_sym() returns -1.
+				*/
+	FFEC_ENC_GATHER	= 0x4,	/* Encode row-major: gather all source symbols of
+					each parity symbol and write it once.
+				Default is automatic, by parity region size
+					(see ffec_encode.c).
+				*/
+	FFEC_ENC_SCATTER = 0x8,	/* Encode column-major: read each source symbol once
+					and XOR it into all its parity symbols.
+				*/
+	FFEC_ENC_TILED	= 0x10,	/* Encode column-major, one cache-sized tile
+					of parity symbols at a time.
+				*/
+	FFEC_ENC_LAZY_SORT = 0x20, /* ffec_enc_lazy() sends parity symbols
+					in ascending order, so that each one
+					costs one row to compute.
+				Costs decode efficiency: the first parity symbols
+					received are all in the first rows.
+				*/
+	FFEC_DEC_DEFERRED = 0x40, /* Decode in two phases: ffec_decode_sym()
+					only copies received symbols and peels
+					the matrix symbolically, recording which
+					row recovers each missing symbol;
+					once all source symbols are accounted for,
+					only those rows are XORed (see ffec_decode.c).
+				No psums: a lossless block costs only the copies.
+				Recovered symbols are only in 'dec_source'
+					once ffec_decode_sym() returns 0.
+				Not with ffec_ingest().
+				*/
+	FFEC_DEC_SOLVE	= 0x80,	/* When peeling stalls short of all source symbols,
+					try to finish by inactivation: Gaussian
+					elimination over the few columns peeling
+					cannot get past (see ffec_solve.c).
+				Decodes with fewer symbols, at some CPU cost
+					(bounded by FFEC_SOLVE_INACT).
+				Not with FFEC_DEC_DEFERRED or ffec_ingest().
+				*/
 };
 
 /*	ffec_counts
@@ -90,9 +171,20 @@ struct ffec_counts {
 	uint32_t			p;	/* number of parity symbols */
 	uint32_t			rows;
 	};
+	union {
 	uint32_t			k_decoded;
+	uint32_t			k_encoded; /* see ffec_encode_sym() */
+	};
+	uint32_t			p_encoded; /* parity symbols final; see ffec_encode_range() */
 }__attribute__ ((packed));
 
+struct ffec_enc_csr_;
+struct ffec_ingest_;
+struct ffec_dec_sched_;
+struct ffec_rx_;
+struct ffec_solve_;
+struct ffec_sink_;
+
 /*	ffec_instance
 Caller holds this; passes a reference to it in nearly all calls to ffec.
 TODO: can we shave off some useless kludge from this structure?
@@ -101,6 +193,15 @@ struct ffec_instance {
 	uint64_t			seeds[2];
 	struct pcg_state		rng;
 	struct ffec_counts		cnt;
+	uint32_t			flags;	/* enum ffec_flags */
+
+	/* XOR kernels, chosen by ffec_new():
+		the aligned variants if all symbols (including the caller's
+		'enc_source') are aligned to FFEC_SYM_ALIGN,
+		specialized for 'sym_len' if possible (see FFEC_SYM_SIZES).
+	*/
+	const struct ffec_xor_ops	*xops;
+	int				aligned;
 
 	/* These pointers are allocated and deallocated as a single memory
 		region by ffec.
@@ -120,18 +221,52 @@ struct ffec_instance {
 	void				*scratch; /* FEC does all work here */
 	struct ffec_cell		*cells;	/* ... and the scratch region
 							always begins with the
-							array of cells.
+							array of cells (decode)
+						*/
+	uint32_t			*col_rows; /* ... or just the row of each
+							source cell (encode):
+							see ffec_enc_col()
 						*/
 	};
 	/* references into 'scratch' */
-	struct ffec_row			*rows;
+	union {
+	struct ffec_row			*rows;	/* only on decode */
+	uint32_t			*row_cnt; /* only on encode: source symbols
+							not yet given to ffec_encode_sym()
+							in each row
+						*/
+	};
 	union {
 	uint32_t			*esi_seq; /* only on encode */
-	void				*psums; /* only on decode */
+	void				*psums; /* only on decode: in the parity
+							region, unless it must
+							hold parity symbols
+							(see ffec_psums_own_())
+						*/
 	};
+	/* bitmap of source symbols given to ffec_encode_sym(); only on encode */
+	uint64_t			*enc_done;
+
+	/* last (FFEC_N1_DEGREE -1) parity symbols; only on encode */
+	void				*stair;
+	/* row index of the matrix; only during ffec_enc_lazy() */
+	struct ffec_enc_csr_		*enc_csr;
+
+	/* CRC32C of each source symbol (see FFEC_CRC) */
+	uint32_t			*crc;
 
 	/* recursion stack|lifo; only on decode */
 	struct lifo			*stk;
+	/* multi-producer ingest queue; only after ffec_ingest_init() */
+	struct ffec_ingest_		*ingest;
+	/* XOR schedule; only on decode with FFEC_DEC_DEFERRED */
+	struct ffec_dec_sched_		*dec_sched;
+	/* receive slots; only after ffec_rx_init() (see ffec_io.h) */
+	struct ffec_rx_			*rx;
+	/* inactivation state; only on decode with FFEC_DEC_SOLVE */
+	struct ffec_solve_		*solve;
+	/* decoded-output sink; only after ffec_sink_init() */
+	struct ffec_sink_		*sink;
 };
 
 
@@ -154,6 +289,8 @@ NLC_LOCAL	int	ffec_calc_sym_counts_	(const struct ffec_params *fp,
 						struct ffec_counts	*fc);
 NLC_LOCAL	int	ffec_calc_lengths_	(const struct ffec_params *fp,
 						struct ffec_instance	*fi);
+NLC_LOCAL	int	ffec_psums_own_		(const struct ffec_params *fp,
+						struct ffec_instance	*fi);
 
 
 /*
@@ -161,6 +298,9 @@ NLC_LOCAL	int	ffec_calc_lengths_	(const struct ffec_params *fp,
 */
 NLC_PUBLIC	uint32_t	ffec_encode	(const struct ffec_params	*fp,
 						struct ffec_instance		*fi);
+NLC_PUBLIC	uint32_t	ffec_encode_mt	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						unsigned int			threads);
 
 
 /*
@@ -196,25 +336,160 @@ NLC_INLINE struct ffec_symbol ffec_enc_seq (const struct ffec_params	*fp,
 }
 
 
+/*
+	ffec_encode.c: incremental (needs 'struct ffec_symbol')
+*/
+NLC_PUBLIC	uint32_t	ffec_encode_sym	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						struct ffec_symbol		sym);
+NLC_PUBLIC	uint32_t	ffec_encode_range(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						uint32_t			first,
+						uint32_t			last);
+NLC_PUBLIC	struct ffec_symbol ffec_enc_lazy(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						uint32_t			i);
+NLC_LOCAL	void		ffec_enc_free_	(struct ffec_instance		*fi);
+
+
 /*
 	ffec_decode.c
 */
 NLC_PUBLIC	uint32_t	ffec_decode_sym	(const struct ffec_params	*fp,
 						struct ffec_instance		*fi,
 						struct ffec_symbol		sym);
+NLC_PUBLIC	uint32_t	ffec_decode_batch(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						const struct ffec_symbol	*syms,
+						uint32_t			cnt);
+NLC_LOCAL	void		ffec_dec_free_	(struct ffec_instance		*fi);
+NLC_LOCAL	int		ffec_dec_known_	(const struct ffec_instance	*fi,
+						uint32_t			esi);
+NLC_LOCAL	int		ffec_dec_sched_finish_(const struct ffec_params *fp,
+						struct ffec_instance		*fi);
+
+
+/*
+	ffec_ingest.c: decode fed by several receive threads
+*/
+NLC_PUBLIC	int		ffec_ingest_init(const struct ffec_params	*fp,
+						struct ffec_instance		*fi);
+NLC_PUBLIC	int		ffec_ingest	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						struct ffec_symbol		sym);
+NLC_PUBLIC	uint32_t	ffec_ingest_drain(const struct ffec_params	*fp,
+						struct ffec_instance		*fi);
+NLC_LOCAL	void		ffec_ingest_free_(struct ffec_instance		*fi);
+
+
+/*
+	ffec_io.c: receive slots (public API in ffec_io.h)
+*/
+NLC_LOCAL	int		ffec_rx_own_	(struct ffec_instance		*fi,
+						uint32_t			esi);
+NLC_LOCAL	void		ffec_rx_free_	(struct ffec_instance		*fi);
+
+
+/*
+	ffec_solve.c: inactivation decoding (see FFEC_DEC_SOLVE)
+*/
+NLC_LOCAL	int		ffec_solve_	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi);
+NLC_LOCAL	void		ffec_solve_free_(struct ffec_instance		*fi);
+
+
+/*
+	ffec_sink.c: decoded-output sink
+*/
+/*	ffec_sink_f
+Told that source symbol 'esi' is final (its data is at 'sym'),
+	and that all those below 'low' are.
+Returns 0 to carry on; anything else is an error, which the decode call
+	returns (decoding itself is not affected).
+*/
+typedef int	(*ffec_sink_f)		(const struct ffec_params	*fp,
+					const struct ffec_instance	*fi,
+					uint32_t			esi,
+					const void			*sym,
+					uint32_t			low,
+					void				*arg);
+
+NLC_PUBLIC	int		ffec_sink_init	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						ffec_sink_f			cb,
+						void				*arg);
+NLC_PUBLIC	int		ffec_sink_fd	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						int				fd);
+NLC_PUBLIC	uint32_t	ffec_sink_low	(const struct ffec_instance	*fi);
+NLC_LOCAL	int		ffec_sink_done_	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						uint32_t			esi);
+NLC_LOCAL	void		ffec_sink_free_	(struct ffec_instance		*fi);
 
 /*
 	ffec_rand.c
 */
-NLC_LOCAL	void	ffec_esi_rand_	(const struct ffec_instance	*fi);
-NLC_LOCAL	void	ffec_gen_matrix_(struct ffec_instance		*fi);
+NLC_LOCAL	void	ffec_esi_rand_	(const struct ffec_instance	*fi,
+					uint32_t			*esi_seq);
+NLC_LOCAL	void	ffec_gen_matrix_(const struct ffec_params	*fp,
+					struct ffec_instance		*fi);
 
 
 /*
 	ffec_xor.c
 */
-NLC_LOCAL	void	__attribute__((regparm(3)))
-			ffec_xor_into_symbol_	(const void *from, void *to, uint32_t sym_len);
+typedef void	(*ffec_xor_f)		(const void *from, void *to, uint32_t sym_len);
+
+typedef void	(*ffec_xor_gather_f)	(const void *const *from, uint32_t cnt,
+					void *to, uint32_t sym_len);
+typedef void	(*ffec_xor_gather_nt_f)	(const void *const *from, uint32_t cnt,
+					void *to, void *copy, uint32_t sym_len);
+typedef void	(*ffec_xor_scatter_f)	(const void *from, void *const *to, uint32_t cnt,
+					uint32_t sym_len);
+typedef void	(*ffec_xor_copy_scatter_f)(const void *from, void *copy,
+					void *const *to, uint32_t cnt,
+					uint32_t sym_len);
+typedef uint32_t (*ffec_xor_scatter_crc_f)(const void *from, void *copy,
+					void *const *to, uint32_t cnt,
+					uint32_t sym_len, int nt);
+
+/*	ffec_xor_ops
+One set of kernels, bound at load time to the best this CPU supports;
+	'_nt' kernels use streaming stores for their final destination
+	(see FFEC_NT_STORE).
+*/
+struct ffec_xor_ops {
+	ffec_xor_f			into_symbol;
+	ffec_xor_gather_f		gather;
+	ffec_xor_gather_nt_f		gather_nt;
+	ffec_xor_scatter_f		scatter;
+	ffec_xor_copy_scatter_f		copy_scatter;
+	ffec_xor_copy_scatter_f		copy_scatter_nt;
+	ffec_xor_scatter_crc_f		scatter_crc; /* also returns CRC32C of 'from' */
+};
+
+NLC_LOCAL const struct ffec_xor_ops *ffec_xor_ops_(uint32_t sym_len, int aligned);
+
+NLC_PUBLIC	void		ffec_xor_gather	(const void *const	*from,
+						uint32_t		cnt,
+						void			*to,
+						uint32_t		sym_len);
+NLC_PUBLIC	void		ffec_xor_scatter(const void		*from,
+						void *const		*to,
+						uint32_t		cnt,
+						uint32_t		sym_len);
+NLC_PUBLIC	void		ffec_xor_copy_scatter(const void	*from,
+						void			*copy,
+						void *const		*to,
+						uint32_t		cnt,
+						uint32_t		sym_len);
+
+NLC_PUBLIC	uint32_t	ffec_crc32c	(const void		*buf,
+						uint32_t		len);
+
+NLC_PUBLIC	int		ffec_xor_bind	(const char *isa);
+NLC_PUBLIC	const char	*ffec_xor_isa	(void);
 
 
 /*
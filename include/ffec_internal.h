@@ -12,4 +12,125 @@ NLC_INLINE struct ffec_cell	*ffec_get_col_first(struct ffec_cell *cells, uint32_
 	return &cells[col * FFEC_N1_DEGREE];
 }
 
+/*	ffec_enc_col()
+Encode-only: gets the rows of the FFEC_N1_DEGREE cells in source column 'col'.
+The encoder never modifies its matrix, so it keeps only these:
+	no linked lists, and no parity cells (the staircase is implicit).
+*/
+NLC_INLINE uint32_t	*ffec_enc_col	(const struct ffec_instance *fi, uint32_t col)
+{
+	return &fi->col_rows[col * FFEC_N1_DEGREE];
+}
+
+/*	ffec_enc_done_test()
+Encode-only: returns 1 if source symbol 'esi' was given to ffec_encode_sym().
+*/
+NLC_INLINE int		ffec_enc_done_test(const struct ffec_instance *fi, uint32_t esi)
+{
+	return (fi->enc_done[esi / 64] >> (esi % 64)) & 0x1;
+}
+
+/*	ffec_enc_done_set()
+*/
+NLC_INLINE void		ffec_enc_done_set(struct ffec_instance *fi, uint32_t esi)
+{
+	fi->enc_done[esi / 64] |= 1ULL << (esi % 64);
+}
+
+/*	ffec_ingest_
+Multi-producer ingest queue (see ffec_ingest.c).
+Every ESI is queued at most once (see 'claimed'),
+	so the ring holds 'n' slots and never wraps.
+*/
+struct ffec_ingest_ {
+	uint64_t	*claimed;	/* ESIs copied (or being copied) into the matrix */
+	uint64_t	*drained;	/* consumer only: ESIs taken off the ring */
+	uint64_t	*waiting;	/* consumer only: source ESIs recovered while
+						their received copy was in flight
+					*/
+	uint32_t	*ring;		/* 'ESI +1' of each queued symbol; 0 until published */
+	uint32_t	waiting_cnt;
+	uint32_t	head;		/* consumer only: next slot to drain */
+	/* producers: next slot to fill; away from what the consumer writes */
+	uint32_t	tail __attribute__((aligned(64)));
+};
+
+/*	ffec_ingest_claim_()
+Atomically take ownership of the matrix slot of 'esi'.
+Returns 1 if the caller got it, 0 if someone already had it.
+*/
+NLC_INLINE int		ffec_ingest_claim_(struct ffec_ingest_ *ing, uint32_t esi)
+{
+	uint64_t bit = 1ULL << (esi % 64);
+	return !(__atomic_fetch_or(&ing->claimed[esi / 64], bit, __ATOMIC_ACQ_REL) & bit);
+}
+
+/*	ffec_rx_
+Zero-copy receive slots (see ffec_io.c).
+Symbol data is in 'sym_len' blocks of 'dec_source', one per ESI:
+	normally ESI 'i' in block 'i', but receiving an ESI into a block lent
+	for another one swaps the two (see ffec_rx_commit()).
+*/
+struct ffec_rx_ {
+	uint32_t	*map;	/* ESI -> block */
+	uint32_t	*inv;	/* block -> ESI */
+	uint64_t	*lent;	/* blocks lent to the caller */
+	uint32_t	*seq;	/* predicted order of arrival: that of ffec_enc_seq() */
+	uint32_t	*pos;	/* ESI -> position in 'seq' */
+	uint32_t	next;	/* next position in 'seq' to lend */
+	uint32_t	spare;	/* next ESI to try once past the end of 'seq' */
+	uint32_t	lent_cnt;
+	int		done;	/* all source symbols are in their own block */
+	void		*tmp;	/* one symbol: see ffec_rx_finish_() */
+};
+
+/*	ffec_sink_
+Decoded-output sink (see ffec_sink.c).
+*/
+struct ffec_sink_ {
+	ffec_sink_f	cb;
+	void		*arg;
+	uint64_t	*done;		/* source symbols final */
+	uint32_t	low;		/* all source symbols below this are final */
+	/* ffec_sink_fd() only */
+	int		fd;
+	int		err;		/* a write failed: stop */
+	uint32_t	written;	/* source symbols written out */
+};
+
+/*	ffec_dec_sym()
+Decode-only: get the data of any ESI (they are all contiguous: faster)
+*/
+NLC_INLINE void	*ffec_dec_sym		(const struct ffec_params	*fp,
+					const struct ffec_instance	*fi,
+					uint32_t			esi)
+{
+	if (fi->rx)
+		esi = fi->rx->map[esi];
+	return fi->dec_source + ((size_t)fp->sym_len * esi);
+}
+
+/*	ffec_get_psum()
+Decode-only: the PartialSum of 'row'.
+*/
+NLC_INLINE void	*ffec_get_psum		(const struct ffec_params	*fp,
+					const struct ffec_instance	*fi,
+					uint32_t			row)
+{
+	return fi->psums + ((size_t)fp->sym_len * row);
+}
+
+/*	ffec_solve_
+Inactivation decoding (see ffec_solve.c).
+The counts are kept up to date by ffec_decode_sym(),
+	so that deciding whether to try costs nothing.
+*/
+struct ffec_solve_ {
+	uint32_t	unknown;	/* columns neither received nor recovered */
+	uint32_t	empty;		/* rows with no such column left */
+	uint32_t	next;		/* try (again) once 'unknown' is down to this */
+	uint32_t	*col_of;	/* ESI -> column of the residual system */
+	uint32_t	*row_of;	/* row -> row of the residual system */
+};
+
 #endif /* ffec_internal_h_ */
@@ -0,0 +1,98 @@
+#ifndef ffec_io_h_
+#define ffec_io_h_
+
+/*	ffec_io.h
+
+Zero-copy transmit: scatter-gather I/O vectors for the symbols of a block.
+Zero-copy receive: receive slots carved from the decoder's own memory.
+Kept out of ffec.h so that it doesn't drag in socket headers.
+*/
+
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE /* struct mmsghdr; sendmmsg() */
+#endif
+#include <sys/uio.h> /* struct iovec */
+#include <sys/socket.h>
+#include <arpa/inet.h> /* htonl(); ntohl() */
+
+#include <ffec.h>
+
+
+/*	Wire format
+Each symbol is sent as an ESI header (FFEC_IO_HDR_LEN Bytes:
+	the ESI as a big-endian uint32_t) followed by the symbol itself,
+	in 2 I/O vectors: see ffec_enc_iov().
+*/
+#define FFEC_IO_HDR_LEN sizeof(uint32_t)
+#define FFEC_IO_IOV 2
+
+NLC_PUBLIC	uint32_t	ffec_enc_iov	(const struct ffec_params	*fp,
+						const struct ffec_instance	*fi,
+						uint32_t			i,
+						uint32_t			cnt,
+						uint32_t			*hdr,
+						struct iovec			*iov);
+
+#ifdef __linux__
+NLC_PUBLIC	uint32_t	ffec_enc_mmsg	(const struct ffec_params	*fp,
+						const struct ffec_instance	*fi,
+						uint32_t			i,
+						uint32_t			cnt,
+						uint32_t			*hdr,
+						struct iovec			*iov,
+						struct mmsghdr			*msgs);
+#endif
+
+NLC_PUBLIC	int		ffec_rx_init	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi);
+NLC_PUBLIC	void		*ffec_rx_slot	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						uint32_t			*slot);
+NLC_PUBLIC	uint32_t	ffec_rx_release	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						uint32_t			slot);
+NLC_PUBLIC	uint32_t	ffec_rx_commit	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						uint32_t			slot,
+						uint32_t			esi);
+
+#ifdef __linux__
+NLC_PUBLIC	uint32_t	ffec_rx_mmsg	(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						uint32_t			cnt,
+						uint32_t			*slots,
+						uint32_t			*hdr,
+						struct iovec			*iov,
+						struct mmsghdr			*msgs);
+NLC_PUBLIC	uint32_t	ffec_rx_mmsg_commit(const struct ffec_params	*fp,
+						struct ffec_instance		*fi,
+						uint32_t			lent,
+						uint32_t			rcvd,
+						const uint32_t			*slots,
+						const uint32_t			*hdr,
+						const struct mmsghdr		*msgs);
+#endif
+
+
+/*	ffec_io_sym()
+Receive side: parse a received datagram of 'len' Bytes into a symbol,
+	which points into the datagram (no copy) and can be handed
+	straight to ffec_decode_sym().
+Returns a symbol with 'sym' NULL if the datagram is not a symbol of 'fi'.
+*/
+NLC_INLINE struct ffec_symbol ffec_io_sym (const struct ffec_params	*fp,
+					const struct ffec_instance	*fi,
+					const void			*buf,
+					size_t				len)
+{
+	struct ffec_symbol ret = { 0 };
+	if (len != FFEC_IO_HDR_LEN + fp->sym_len)
+		return ret;
+	ret.esi = ntohl(*(const uint32_t *)buf);
+	if (ret.esi < fi->cnt.n)
+		ret.sym = buf + FFEC_IO_HDR_LEN;
+	return ret;
+}
+
+
+#endif /* ffec_io_h_ */
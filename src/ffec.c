@@ -20,6 +20,37 @@ NLC_INLINE size_t	ffec_len_rows	(const struct ffec_counts *fc)
 	return sizeof(struct ffec_row) * fc->rows;
 }
 
+/*	ffec_len_col_rows()
+Encode-only matrix: the row of each source cell.
+*/
+NLC_INLINE size_t	ffec_len_col_rows(const struct ffec_counts *fc)
+{
+	return sizeof(uint32_t) * fc->k * FFEC_N1_DEGREE;
+}
+
+/*	ffec_len_row_cnt()
+*/
+NLC_INLINE size_t	ffec_len_row_cnt(const struct ffec_counts *fc)
+{
+	return sizeof(uint32_t) * fc->rows;
+}
+
+/*	ffec_len_enc_done()
+*/
+NLC_INLINE size_t	ffec_len_enc_done(const struct ffec_counts *fc)
+{
+	return sizeof(uint64_t) * nm_div_ceil(fc->k, 64);
+}
+
+/*	ffec_len_align()
+Round 'len' up to a multiple of FFEC_MEM_ALIGN, so that whatever follows
+	a region of 'len' Bytes is aligned no matter what 'sym_len' is.
+*/
+NLC_INLINE size_t	ffec_len_align	(size_t len)
+{
+	return (len + FFEC_MEM_ALIGN -1) & ~((size_t)FFEC_MEM_ALIGN -1);
+}
+
 
 /*	ffec_new()
 
@@ -66,9 +97,10 @@ struct ffec_instance	*ffec_new(const struct ffec_params	*fp,
 		ret->enc_source = src;
 	ret->source_len = src_len;
 
-	/* alignment */
-	NB_die_if((fp->sym_len / FFEC_SYM_ALIGN * FFEC_SYM_ALIGN) != fp->sym_len,
-		"requested sym_len %"PRIu32" not a multiple of %"PRIu32,
+	/* any length works; multiples of FFEC_SYM_ALIGN are fastest */
+	NB_die_if(!fp->sym_len, "sym_len mandatory");
+	NB_wrn_if(fp->sym_len % FFEC_SYM_ALIGN,
+		"sym_len %"PRIu32" not a multiple of %"PRIu32": slower XOR tail",
 		fp->sym_len, FFEC_SYM_ALIGN);
 	/* calculate symbol counts */
 	NB_die_if(
@@ -80,31 +112,66 @@ struct ffec_instance	*ffec_new(const struct ffec_params	*fp,
 		, "");
 
 
-	/* DECODE: alloc ALL memory */
+	/* DECODE: alloc ALL memory
+	NOTE that parity MUST directly follow source (see ffec_dec_sym()),
+		so only the scratch region is padded to alignment.
+	*/
 	if (!ret->enc_source) {
-		size_t alloc = ret->source_len + ret->parity_len + ret->scratch_len;
-		NB_die_if(!(
-			ret->dec_source = malloc(alloc)
-			), "alloc %zu", alloc);
+		size_t syms = ffec_len_align(ret->source_len + ret->parity_len);
+		size_t alloc = syms + ret->scratch_len;
+		NB_die_if(posix_memalign(&ret->dec_source, FFEC_MEM_ALIGN, alloc),
+			"alloc %zu", alloc);
 		ret->parity = ret->dec_source + ret->source_len;
+		ret->scratch = ret->dec_source + syms;
 
 	/* ENCODE: alloc parity and scratch only */
 	} else {
-		size_t alloc = ret->parity_len + ret->scratch_len;
-		NB_die_if(!(
-			ret->parity = malloc(alloc)
-			), "alloc %zu", alloc);
+		size_t syms = ffec_len_align(ret->parity_len);
+		size_t alloc = syms + ret->scratch_len;
+		NB_die_if(posix_memalign(&ret->parity, FFEC_MEM_ALIGN, alloc),
+			"alloc %zu", alloc);
+		ret->scratch = ret->parity + syms;
 	}
 
 
 	/* Assign pointers into scratch region.
-	NOTE: (cells | scratch) and (esi_seq | psums) are unions;
-			assigning to both for clarity
+	NOTE: (cells | col_rows | scratch), (rows | row_cnt)
+		and (esi_seq | psums) are unions.
 	*/
-	ret->cells = ret->scratch = ret->parity + ret->parity_len;
-	ret->rows = ret->scratch + ffec_len_cells(&ret->cnt);
-	/* psums when decoding, esi_seq when encoding */
-	ret->esi_seq = ret->psums = ((void*)ret->rows) + ffec_len_rows(&ret->cnt);
+	/* encoding: compact matrix, then ESI sequence and staircase ring */
+	if (ret->enc_source) {
+		ret->col_rows = ret->scratch;
+		ret->row_cnt = ret->scratch
+			+ ffec_len_align(ffec_len_col_rows(&ret->cnt));
+		ret->enc_done = ((void *)ret->row_cnt)
+			+ ffec_len_align(ffec_len_row_cnt(&ret->cnt));
+		ret->esi_seq = ((void *)ret->enc_done)
+			+ ffec_len_align(ffec_len_enc_done(&ret->cnt));
+		ret->stair = ((void *)ret->esi_seq)
+			+ ffec_len_align(ret->cnt.n * sizeof(uint32_t));
+		ret->crc = ret->stair
+			+ ffec_len_align((size_t)fp->sym_len * (FFEC_N1_DEGREE -1));
+	/* decoding: matrix, then CRCs.
+	The psum of row 'i' lives in the block of parity symbol 'i'
+		(there are as many rows as parity symbols):
+		a parity symbol is only ever read to be XORed into psums,
+		so ffec_decode_sym() never stores it (see ffec_psums_own_()).
+	*/
+	} else {
+		ret->cells = ret->scratch;
+		ret->rows = ret->scratch + ffec_len_cells(&ret->cnt);
+		ret->crc = ret->scratch
+			+ ffec_len_align(ffec_len_cells(&ret->cnt) + ffec_len_rows(&ret->cnt));
+		ret->psums = ret->parity;
+	}
+	/* Every symbol (source, parity, psums, staircase ring) is aligned
+		if the first one is and 'sym_len' keeps them so:
+		aligned loads and stores can be used throughout.
+	*/
+	ret->aligned = !(fp->sym_len % FFEC_SYM_ALIGN)
+		&& !((uintptr_t)(src ? src : ret->dec_source) % FFEC_SYM_ALIGN);
+	ret->xops = ffec_xor_ops_(fp->sym_len, ret->aligned);
+
 	/* zero the scratch region */
 	memset(ret->scratch, 0x0, ret->scratch_len);
 
@@ -127,7 +194,7 @@ struct ffec_instance	*ffec_new(const struct ffec_params	*fp,
 		ret->seeds[0], ret->seeds[1], ret->cnt.k, ret->cnt.n, ret->cnt.p);
 
 	/* init the matrix */
-	ffec_gen_matrix_(ret);
+	ffec_gen_matrix_(fp, ret);
 
 
 	/* encoding: the parity region will be zeroed by the encoder function
@@ -135,11 +202,10 @@ struct ffec_instance	*ffec_new(const struct ffec_params	*fp,
 	We do however need a sequence of ESIs to send over the wire.
 	*/
 	if (ret->enc_source) {
-		ffec_esi_rand_(ret);
-	/* decoding: zero parity region */
+		ffec_esi_rand_(ret, ret->esi_seq);
+	/* decoding: zero parity region (psums) */
 	} else {
 		memset(ret->parity, 0x0, ret->parity_len);
-		memset(ret->psums, 0x0, ret->cnt.rows * fp->sym_len);
 	}
 
 
@@ -159,29 +225,72 @@ void			ffec_free(struct ffec_instance		*fi)
 		return;
 
 	/* symbol regions */
-	if (fi->dec_source)
+	if (fi->dec_source) {
+		if (fi->psums != fi->parity)
+			free(fi->psums);
 		free(fi->dec_source);
-	else if (fi->parity)
+	} else if (fi->parity) {
 		free(fi->parity);
+	}
 
 	/* stack */
 	lifo_free(fi->stk);
+	/* lazy encode state */
+	ffec_enc_free_(fi);
+	/* multi-producer ingest state */
+	ffec_ingest_free_(fi);
+	/* deferred decode state */
+	ffec_dec_free_(fi);
+	/* receive slots */
+	ffec_rx_free_(fi);
+	/* inactivation state */
+	ffec_solve_free_(fi);
+	/* decoded-output sink */
+	ffec_sink_free_(fi);
 
 	free(fi);
 }
 
 
 /*	ffec_test_esi()
-Returns 1 if 'esi' is already decoded, 0 otherwise.
+Returns 1 if 'esi' is already decoded
+	(on encode: already given to ffec_encode_sym()), 0 otherwise.
 */
 int		ffec_test_esi	(const struct ffec_instance	*fi,
 				uint32_t			esi)
 {
+	if (fi->enc_source)
+		return ffec_enc_done_test(fi, esi);
 	/* if this cell has been unlinked, unwind the recursion stack */
 	return ffec_cell_test(ffec_get_col_first(fi->cells, esi));
 }
 
 
+/*	ffec_psums_own_()
+Decode-only: move the psums out of the parity region, into their own memory.
+Needed by whatever puts parity symbols into their blocks before they are
+	decoded (ffec_ingest_init(), ffec_rx_init()): those blocks would
+	otherwise be psums.
+Parity symbols decoded so far have been XORed in already: their blocks
+	are of no further use, whatever they hold.
+returns 0 on success
+*/
+int		ffec_psums_own_	(const struct ffec_params	*fp,
+				struct ffec_instance		*fi)
+{
+	int err_cnt = 0;
+	if (fi->psums != fi->parity)
+		return 0;
+	void *psums = NULL;
+	NB_die_if(posix_memalign(&psums, FFEC_MEM_ALIGN, fi->parity_len),
+		"alloc %zu", fi->parity_len);
+	memcpy(psums, fi->parity, fi->parity_len);
+	fi->psums = psums;
+die:
+	return err_cnt;
+}
+
+
 /*	ffec_calc_sym_counts_()
 Calculate the symbol counts for a given source length and FEC params.
 Populates them into 'fc', which must be allocated by the caller.
@@ -232,6 +341,7 @@ int		ffec_calc_sym_counts_(const struct ffec_params	*fp,
 	fc->k = t_k;
 	fc->p = t_p;
 	fc->k_decoded = 0; /* because common sense */
+	fc->p_encoded = 0;
 
 die:
 	if (err_cnt)
@@ -257,19 +367,32 @@ int		ffec_calc_lengths_(const struct ffec_params	*fp,
 	psum = (uint64_t)fp->sym_len * fi->cnt.rows;
 
 	/* Combined size must not exceed UINT32_MAX;
-	count 'psum' even on ENCODE; since it's no good to encode
-		something the receiver can't decode!
+	count 'psum' (and the decoder's matrix) even on ENCODE;
+		since it's no good to encode something the receiver can't decode!
 	*/
 	NB_die_if(src + par + scr + psum > (uint64_t)UINT32_MAX -2,
 		"cannot handle combined symbol space of %"PRIu64,
 		src + par + scr + psum);
 
-	/* if decoding, scratch must have space for psums */
+	/* Regions within scratch start on FFEC_MEM_ALIGN boundaries,
+		whatever 'sym_len' is.
+	*/
+	/* if decoding, scratch must have space for matrix
+		(psums are in the parity region: see ffec_new())
+	*/
 	if (!fi->enc_source)
-		scr += psum;
-	/* if encoding, must have space for ESI sequence */
+		scr = ffec_len_align(scr);
+	/* if encoding, must have space for compact matrix,
+		ESI sequence and staircase ring
+	*/
 	else
-		scr += fi->cnt.n * sizeof(uint32_t);
+		scr = ffec_len_align(ffec_len_col_rows(&fi->cnt))
+			+ ffec_len_align(ffec_len_row_cnt(&fi->cnt))
+			+ ffec_len_align(ffec_len_enc_done(&fi->cnt))
+			+ ffec_len_align(fi->cnt.n * sizeof(uint32_t))
+			+ ffec_len_align((uint64_t)fp->sym_len * (FFEC_N1_DEGREE -1));
+	/* either way: a CRC for each source symbol */
+	scr += fi->cnt.k * sizeof(uint32_t);
 
 	fi->source_len = src;
 	fi->parity_len = par;
@@ -8,26 +8,14 @@ TODO:
 
 #include <ffec_internal.h>
 
-
-/*	ffec_dec_sym()
-Decode-only: get any ESI (they are all contiguous: faster)
-*/
-NLC_INLINE void	*ffec_dec_sym		(const struct ffec_params	*fp,
-					const struct ffec_instance	*fi,
-					uint32_t			esi)
-{
-	return fi->dec_source + (fp->sym_len * esi);
-}
-
-
-/*	ffec_get_psum()
-*/
-NLC_INLINE void	*ffec_get_psum		(const struct ffec_params	*fp,
-					struct ffec_instance		*fi,
-					uint32_t			row)
-{
-	return fi->psums + (fp->sym_len * row);
-}
+/* ffec_decode_batch(): number of symbols ahead to prefetch */
+#ifndef FFEC_DEC_AHEAD
+	#define FFEC_DEC_AHEAD 4
+#endif
+/* ffec_decode_batch(): Bytes at the head of each psum to prefetch */
+#ifndef FFEC_DEC_PSUM_AHEAD
+	#define FFEC_DEC_PSUM_AHEAD 256
+#endif
 
 
 /*	ffec_esi_row_t
@@ -44,12 +32,340 @@ typedef struct {
 } __attribute__((packed)) ffec_esi_row_t;
 
 
+/* FFEC_DEC_DEFERRED: max number of symbols XORed by one call to the gather kernel */
+#define FFEC_DEC_GATHER_CNT 16
+
+/*	ffec_dec_sched_
+FFEC_DEC_DEFERRED: what phase 2 must compute.
+*/
+struct ffec_dec_sched_ {
+	uint32_t		cnt;
+	int			done;	/* phase 2 has run */
+	uint64_t		*have;	/* ESIs whose data is in the matrix: received
+						(or computed by phase 2)
+					*/
+	ffec_esi_row_t		*ent;	/* ESI recovered and its row, in peeling order */
+};
+
+
+/*	ffec_dec_have_()
+*/
+NLC_INLINE int		ffec_dec_have_	(const struct ffec_dec_sched_	*sd,
+					uint32_t			esi)
+{
+	return (sd->have[esi / 64] >> (esi % 64)) & 0x1;
+}
+
+
+/*	ffec_dec_free_()
+Free deferred decode state; called by ffec_free().
+*/
+void		ffec_dec_free_		(struct ffec_instance		*fi)
+{
+	if (!fi->dec_sched)
+		return;
+	free(fi->dec_sched->have);
+	free(fi->dec_sched->ent);
+	free(fi->dec_sched);
+	fi->dec_sched = NULL;
+}
+
+
+/*	ffec_dec_known_()
+Returns 1 if the data of 'esi' is in the matrix, or will be without
+	receiving it: with FFEC_DEC_DEFERRED, only once received
+	(recovered symbols are only computed at the end).
+*/
+int		ffec_dec_known_		(const struct ffec_instance	*fi,
+					uint32_t			esi)
+{
+	if (!(fi->flags & FFEC_DEC_DEFERRED))
+		return ffec_test_esi(fi, esi);
+	return fi->dec_sched && (fi->dec_sched->done || ffec_dec_have_(fi->dec_sched, esi));
+}
+
+
+/*	ffec_dec_sched_new_()
+*/
+static struct ffec_dec_sched_ *ffec_dec_sched_new_(struct ffec_instance	*fi)
+{
+	int err_cnt = 0;
+	NB_die_if(!(
+		fi->dec_sched = calloc(1, sizeof(*fi->dec_sched))
+		), "");
+	NB_die_if(!(
+		fi->dec_sched->have = calloc((fi->cnt.n + 63) / 64, sizeof(uint64_t))
+		), "");
+	NB_die_if(!(
+		fi->dec_sched->ent = malloc(sizeof(ffec_esi_row_t) * fi->cnt.n)
+		), "");
+	return fi->dec_sched;
+die:
+	ffec_dec_free_(fi);
+	return NULL;
+}
+
+
+/*	ffec_dec_sched_run_()
+FFEC_DEC_DEFERRED phase 2: compute the source symbols which were recovered
+	and not received in the meantime, as the XOR of all the other
+	symbols of their row.
+Peeling may have gone through other recovered symbols (parity, mostly)
+	to get there: walking the schedule backwards gives just those
+	which are needed; they are computed in peeling order,
+	which guarantees the rest of each row is known by then.
+Rows are indexed (counting sort) only if there is anything to compute,
+	and then only the rows of symbols not received.
+returns 0 on success
+*/
+static int	ffec_dec_sched_run_	(const struct ffec_params	*fp,
+					struct ffec_instance		*fi)
+{
+	int err_cnt = 0;
+	struct ffec_dec_sched_ *sd = fi->dec_sched;
+	uint64_t *need = NULL, *want = NULL;
+	uint32_t *first = NULL, *ids = NULL;
+
+	uint32_t i, todo = 0;
+	for (i=0; i < sd->cnt; i++) {
+		if (sd->ent[i].esi < fi->cnt.k && !ffec_dec_have_(sd, sd->ent[i].esi))
+			break;
+	}
+	if (i == sd->cnt)
+		goto die;
+
+#define TEST(bmp, id) (((bmp)[(id) / 64] >> ((id) % 64)) & 0x1)
+#define SET(bmp, id) ((bmp)[(id) / 64] |= 1ULL << ((id) % 64))
+	NB_die_if(!(
+		need = calloc((fi->cnt.p + 63) / 64, sizeof(uint64_t))
+		), "");
+	NB_die_if(!(
+		want = calloc((fi->cnt.n + 63) / 64, sizeof(uint64_t))
+		), "");
+	NB_die_if(!(
+		first = calloc(fi->cnt.p + 2, sizeof(uint32_t))
+		), "");
+	for (i=0; i < sd->cnt; i++) {
+		if (!ffec_dec_have_(sd, sd->ent[i].esi))
+			SET(need, sd->ent[i].row);
+	}
+
+	/* count members of needed rows: cells keep their row when unlinked */
+	const uint32_t src_cells = fi->cnt.k * FFEC_N1_DEGREE;
+	for (uint32_t c=0; c < src_cells; c++) {
+		if (TEST(need, fi->cells[c].row_id))
+			first[fi->cells[c].row_id +2]++;
+	}
+	/* staircase: parity symbol 'j' is in rows 'j' to 'j + FFEC_N1_DEGREE -1' */
+	for (uint32_t j=0; j < fi->cnt.p; j++) {
+		for (uint32_t r=j; r < j + FFEC_N1_DEGREE && r < fi->cnt.p; r++) {
+			if (TEST(need, r))
+				first[r +2]++;
+		}
+	}
+	for (uint32_t r=0; r < fi->cnt.p; r++)
+		first[r +2] += first[r +1];
+	NB_die_if(!(
+		ids = malloc(sizeof(uint32_t) * first[fi->cnt.p +1])
+		), "");
+	/* fill: 'first[row +1]' is the fill position of 'row' */
+	for (uint32_t c=0; c < src_cells; c++) {
+		if (TEST(need, fi->cells[c].row_id))
+			ids[first[fi->cells[c].row_id +1]++] = c / FFEC_N1_DEGREE;
+	}
+	for (uint32_t j=0; j < fi->cnt.p; j++) {
+		for (uint32_t r=j; r < j + FFEC_N1_DEGREE && r < fi->cnt.p; r++) {
+			if (TEST(need, r))
+				ids[first[r +1]++] = fi->cnt.k + j;
+		}
+	}
+
+	/* backwards: missing sources, and what they are recovered from */
+	for (i = sd->cnt; i > 0; i--) {
+		const uint32_t esi = sd->ent[i-1].esi;
+		const uint32_t row = sd->ent[i-1].row;
+		if (ffec_dec_have_(sd, esi) || (esi >= fi->cnt.k && !TEST(want, esi)))
+			continue;
+		SET(want, esi);
+		for (uint32_t j = first[row]; j < first[row +1]; j++) {
+			if (!ffec_dec_have_(sd, ids[j]))
+				SET(want, ids[j]);
+		}
+	}
+
+	/* forwards: compute */
+	const void *from[FFEC_DEC_GATHER_CNT];
+	for (i=0; i < sd->cnt; i++) {
+		const uint32_t esi = sd->ent[i].esi;
+		const uint32_t row = sd->ent[i].row;
+		if (ffec_dec_have_(sd, esi) || !TEST(want, esi))
+			continue;
+		todo++;
+		void *to = ffec_dec_sym(fp, fi, esi);
+		uint32_t cnt = 0;
+		for (uint32_t j = first[row]; j < first[row +1]; j++) {
+			if (ids[j] == esi)
+				continue;
+			if (cnt == FFEC_DEC_GATHER_CNT) {
+				fi->xops->gather(from, cnt, to, fp->sym_len);
+				cnt = 0;
+				from[cnt++] = to;
+			}
+			from[cnt++] = ffec_dec_sym(fp, fi, ids[j]);
+		}
+		fi->xops->gather(from, cnt, to, fp->sym_len);
+		SET(sd->have, esi);
+
+		if ((fi->flags & FFEC_CRC) && esi < fi->cnt.k) {
+			uint32_t crc = ffec_crc32c(to, fp->sym_len);
+			NB_err_if(crc != fi->crc[esi],
+				"esi %"PRIu32" (recovered) CRC 0x%"PRIx32" != 0x%"PRIx32,
+				esi, crc, fi->crc[esi]);
+		}
+		if (fi->sink && esi < fi->cnt.k)
+			NB_err_if(ffec_sink_done_(fp, fi, esi), "esi %"PRIu32": sink", esi);
+	}
+#undef TEST
+#undef SET
+
+die:
+	sd->done = 1;
+	NB_wrn("deferred decode: %"PRIu32" of %"PRIu32" recovered symbols computed",
+		todo, sd->cnt);
+	free(need);
+	free(want);
+	free(first);
+	free(ids);
+	return err_cnt;
+}
+
+
+/*	ffec_dec_sched_finish_()
+FFEC_DEC_DEFERRED phase 2, once all source symbols are accounted for
+	(and only once).
+returns 0 on success
+*/
+int		ffec_dec_sched_finish_	(const struct ffec_params	*fp,
+					struct ffec_instance		*fi)
+{
+	struct ffec_dec_sched_ *sd = fi->dec_sched;
+	if (!sd || sd->done || fi->cnt.k_decoded != fi->cnt.k)
+		return 0;
+	/* the stack may hold rows which are now moot */
+	uint64_t index;
+	while (lifo_pop(fi->stk, &index) != LIFO_ERR)
+		;
+	return ffec_dec_sched_run_(fp, fi);
+}
+
+
+/*	ffec_decode_deferred_()
+FFEC_DEC_DEFERRED phase 1, called by ffec_decode_sym():
+	copy a received symbol into the matrix (checking its CRC)
+	and peel the matrix, without touching any symbol data.
+Each symbol recovered by peeling is recorded with the row it's recovered from;
+	if the symbol itself is received before phase 2, its entry is moot.
+Once all source symbols are accounted for, run phase 2.
+
+Return values as ffec_decode_sym().
+*/
+static uint32_t	ffec_decode_deferred_	(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					struct ffec_symbol		sym)
+{
+	int err_cnt = 0;
+	ffec_esi_row_t tmp;
+	struct ffec_dec_sched_ *sd = fi->dec_sched;
+	if (!sd)
+		NB_die_if(!(
+			sd = ffec_dec_sched_new_(fi)
+			), "");
+
+	if (fi->cnt.k_decoded == fi->cnt.k)
+		goto die;
+	NB_die_if(sym.esi >= fi->cnt.n, "esi %"PRIu32" >= n %"PRIu32, sym.esi, fi->cnt.n);
+	if (ffec_dec_have_(sd, sym.esi))
+		goto die;
+
+	/* copy: the one pass over the symbol, which also checks its CRC */
+	void *curr_sym = ffec_dec_sym(fp, fi, sym.esi);
+	const void *from = sym.sym ? sym.sym : curr_sym;
+	const struct ffec_xor_ops *xops = fi->xops;
+	if (fi->aligned && ((uintptr_t)from % FFEC_SYM_ALIGN))
+		xops = ffec_xor_ops_(fp->sym_len, 0);
+	void *copy_to = (from != curr_sym) ? curr_sym : NULL;
+	if ((fi->flags & FFEC_CRC) && sym.esi < fi->cnt.k) {
+		uint32_t crc = xops->scatter_crc(from, copy_to, NULL, 0, fp->sym_len,
+						fi->flags & FFEC_NT_STORE);
+		NB_die_if(crc != fi->crc[sym.esi],
+			"esi %"PRIu32" (received) CRC 0x%"PRIx32" != 0x%"PRIx32,
+			sym.esi, crc, fi->crc[sym.esi]);
+	} else if (copy_to) {
+		if (fi->flags & FFEC_NT_STORE)
+			xops->copy_scatter_nt(from, copy_to, NULL, 0, fp->sym_len);
+		else
+			xops->copy_scatter(from, copy_to, NULL, 0, fp->sym_len);
+	}
+	sd->have[sym.esi / 64] |= 1ULL << (sym.esi % 64);
+	if (fi->sink && sym.esi < fi->cnt.k)
+		NB_err_if(ffec_sink_done_(fp, fi, sym.esi), "esi %"PRIu32": sink", sym.esi);
+
+	/* already recovered (symbolically): no need to compute it after all */
+	struct ffec_cell *cell = ffec_get_col_first(fi->cells, sym.esi);
+	if (ffec_cell_test(cell))
+		goto die;
+
+	/* peel */
+	uint32_t esi = sym.esi;
+	while (1) {
+		if (esi < fi->cnt.k && ++fi->cnt.k_decoded == fi->cnt.k)
+			break;
+
+		for (unsigned int j=0; j < FFEC_N1_DEGREE; j++) {
+			if (ffec_cell_test(&cell[j]))
+				continue;
+			struct ffec_row *row = &fi->rows[cell[j].row_id];
+			ffec_matrix_row_unlink(row, &cell[j], fi->cells);
+			if (row->cnt == 1) {
+				tmp.esi = fi->cells[row->c_last].c_me / FFEC_N1_DEGREE;
+				tmp.row = cell[j].row_id;
+				lifo_push(&fi->stk, tmp.index);
+			}
+		}
+
+		/* next symbol recovered, if any, whose column is still linked */
+		do {
+			uint64_t index;
+			if (lifo_pop(fi->stk, &index) == LIFO_ERR)
+				goto die;
+			tmp.index = index;
+			cell = ffec_get_col_first(fi->cells, tmp.esi);
+		} while (ffec_cell_test(cell));
+		sd->ent[sd->cnt++] = tmp;
+		esi = tmp.esi;
+	}
+
+die:
+	/* Receive slots still lent may be written: ffec_rx_commit() runs it later.
+	Run it even if the sink failed: the block is complete all the same.
+	*/
+	if (!(fi->rx && fi->rx->lent_cnt))
+		err_cnt += ffec_dec_sched_finish_(fp, fi);
+	if (err_cnt)
+		return -1;
+	return fi->cnt.k - fi->cnt.k_decoded;
+}
+
+
 /*	ffec_decode_sym()
 Decode a symbol:
 a. XOR it into the PartialSum for all of its rows.
-b. Copy it into its final location in either "source" or "repair" regions.
+b. If it's a source symbol, copy it into its final location.
 Note that there is no advantage to splicing since we must read
-	the symbol into cache for a.) anyways.
+	the symbol into cache for a.) anyways:
+	a.) and b.) are done in a single pass by the copy_scatter kernel.
+A parity symbol is of no use after a.): it is never stored
+	(its block holds a psum, see ffec_new()).
 c. If any row is now left with only one symbol, the PartialSum of that
 	row IS that symbol: "iteratively decode" by recursing.
 
@@ -65,7 +381,9 @@ The solution is to use a simple 64-bit LIFO struct from nonlibc;
 	it is preallocated in 'fi' ... we reuse it each time we're called.
 
 WARNING: if 'symbol' is NULL, we ASSUME it has already been copied to matrix memory
-	and read it directly from ffec_dec_sym(esi)
+	and read it directly from ffec_dec_sym(esi).
+	For a parity symbol, this is only possible once psums have their own
+	memory (ffec_ingest_init(), ffec_rx_init()).
 */
 uint32_t	ffec_decode_sym		(const struct ffec_params	*fp,
 					struct ffec_instance		*fi,
@@ -75,10 +393,23 @@ uint32_t	ffec_decode_sym		(const struct ffec_params	*fp,
 	/* set up only only once */
 	err_cnt = 0;
 	NB_die_if(!fp || !fi, "args");
+	if (fi->flags & FFEC_DEC_DEFERRED)
+		return ffec_decode_deferred_(fp, fi, sym);
 
 	ffec_esi_row_t tmp;
 	struct ffec_cell *cell = NULL;
 	void *curr_sym = NULL;
+	const void *from = NULL;
+	void *copy_to = NULL;
+	const struct ffec_xor_ops *xops = NULL;
+	ffec_xor_copy_scatter_f copy_scatter = NULL;
+	int nt = fi->flags & FFEC_NT_STORE;
+	/* symbol comes from a psum rather than from caller */
+	int recovered = 0;
+	/* source symbol to be checked against its CRC */
+	int check = 0;
+	/* source symbol whose data a receive thread is still copying */
+	int pending = 0;
 
 recurse:
 
@@ -92,30 +423,91 @@ recurse:
 	if (ffec_cell_test(cell))
 		goto check_recurse;
 
+	/* A recovered source symbol is written to its block, which may be lent out
+		(see ffec_rx_own_()).
+	*/
+	if (recovered && sym.esi < fi->cnt.k)
+		NB_die_if(ffec_rx_own_(fi, sym.esi), "esi %"PRIu32": no free block", sym.esi);
 	/* point to symbol in matrix */
 	curr_sym = ffec_dec_sym(fp, fi, sym.esi);
-	/* if given a pointer, copy symbol from there into matrix */
+	/* If given a pointer, symbol must be copied from there into matrix:
+		this is done in the same pass which XORs it into the psums (below).
+	... otherwise assume it's already there.
+	*/
 	if (sym.sym && sym.sym != curr_sym) {
 		NB_wrn("pull <-(esi %"PRIu32") @0x%"PRIxPTR,
 			sym.esi, (uintptr_t)sym.sym);
-		memcpy(curr_sym, sym.sym, fp->sym_len);
+		from = sym.sym;
+	} else {
+		from = curr_sym;
+		NB_die_if(!recovered && sym.esi >= fi->cnt.k && fi->psums == fi->parity,
+			"esi %"PRIu32": parity in place, but its block is a psum", sym.esi);
+	}
+	/* caller's buffer may not be aligned, even if the matrix is */
+	xops = fi->xops;
+	if (fi->aligned && ((uintptr_t)from % FFEC_SYM_ALIGN))
+		xops = ffec_xor_ops_(fp->sym_len, 0);
+	/* copies into matrix are final: stream them out if caller so wishes */
+	copy_scatter = nt ? xops->copy_scatter_nt : xops->copy_scatter;
+	/* parity is not stored */
+	copy_to = (from != curr_sym && sym.esi < fi->cnt.k) ? curr_sym : NULL;
+	/* ffec_ingest() checks the CRC of received symbols itself */
+	check = (fi->flags & FFEC_CRC) && sym.esi < fi->cnt.k
+		&& (recovered || !fi->ingest);
+
+	/* A receive thread may be copying this very symbol into the matrix
+		(see ffec_ingest()): leave the slot to it and, unless it was
+		already drained, count the symbol as missing until it is.
+	*/
+	pending = 0;
+	if (recovered && fi->ingest && !ffec_ingest_claim_(fi->ingest, sym.esi)) {
+		copy_to = NULL;
+		if (sym.esi < fi->cnt.k
+			&& !((fi->ingest->drained[sym.esi / 64] >> (sym.esi % 64)) & 0x1))
+		{
+			fi->ingest->waiting[sym.esi / 64] |= 1ULL << (sym.esi % 64);
+			fi->ingest->waiting_cnt++;
+			pending = 1;
+		}
 	}
-	/* ... otherwise assume it's already there */
 
 	NB_wrn("decode (esi %"PRIu32") @0x%"PRIxPTR,
 		sym.esi, (uintptr_t)curr_sym);
+	if (fi->solve)
+		fi->solve->unknown--;
 
 	/* If it's a source symbol, log it. */
 	if (sym.esi < fi->cnt.k) {
 		/* We may have just finished.
-		Avoid extra work.
+		Avoid extra work: copy only.
 		*/
-		if (++fi->cnt.k_decoded == fi->cnt.k)
+		if (++fi->cnt.k_decoded == fi->cnt.k) {
+			if (check) {
+				uint32_t crc = xops->scatter_crc(from, copy_to,
+					NULL, 0, fp->sym_len, nt);
+				if (crc != fi->crc[sym.esi] && !recovered) {
+					fi->cnt.k_decoded--;
+					if (fi->solve)
+						fi->solve->unknown++;
+				}
+				NB_die_if(crc != fi->crc[sym.esi],
+					"esi %"PRIu32" (%s) CRC 0x%"PRIx32" != 0x%"PRIx32,
+					sym.esi, recovered ? "recovered" : "received",
+					crc, fi->crc[sym.esi]);
+			} else if (copy_to) {
+				copy_scatter(from, copy_to, NULL, 0, fp->sym_len);
+			}
+			if (fi->sink && !pending)
+				NB_err_if(ffec_sink_done_(fp, fi, sym.esi),
+					"esi %"PRIu32": sink", sym.esi);
 			goto die;
+		}
 	}
 
 	/* get all rows */
 	struct ffec_row *n_rows[FFEC_N1_DEGREE];
+	void *psums[FFEC_N1_DEGREE];
+	uint32_t psum_cnt = 0;
 	memset(&n_rows, 0x0, sizeof(n_rows));
 	for (unsigned int j=0; j < FFEC_N1_DEGREE; j++) {
 		/* if any cells are unset, avoid processing them
@@ -130,16 +522,50 @@ recurse:
 			decoding that row.
 		*/
 		if (n_rows[j]->cnt > 1) {
-			ffec_xor_into_symbol_(curr_sym,
-					ffec_get_psum(fp, fi, cell[j].row_id),
-					fp->sym_len);
+			psums[psum_cnt++] = ffec_get_psum(fp, fi, cell[j].row_id);
 			NB_wrn("xor(esi %"PRIu32") -> p%"PRIu32" @0x%"PRIxPTR,
 				sym.esi, cell[j].row_id,
 				(uintptr_t)ffec_get_psum(fp, fi, cell[j].row_id));
 		}
 		/* remove from row */
 		ffec_matrix_row_unlink(n_rows[j], &cell[j], fi->cells);
+		if (fi->solve && !n_rows[j]->cnt)
+			fi->solve->empty++;
 	}
+	/* read symbol once: copy into matrix (if needed) and XOR into all psums */
+	if (check) {
+		uint32_t crc = xops->scatter_crc(from, copy_to,
+			psums, psum_cnt, fp->sym_len, nt);
+		/* A received symbol which is corrupt is undone:
+			XOR it out of the psums again and relink its cells.
+		*/
+		if (crc != fi->crc[sym.esi] && !recovered) {
+			xops->scatter(from, psums, psum_cnt, fp->sym_len);
+			for (unsigned int j=FFEC_N1_DEGREE; j > 0; j--) {
+				if (!n_rows[j-1])
+					continue;
+				if (fi->solve && !n_rows[j-1]->cnt)
+					fi->solve->empty--;
+				ffec_matrix_row_link(n_rows[j-1], &cell[j-1], fi->cells);
+			}
+			if (fi->solve)
+				fi->solve->unknown++;
+			fi->cnt.k_decoded--;
+			NB_die("esi %"PRIu32" (received) CRC 0x%"PRIx32" != 0x%"PRIx32,
+				sym.esi, crc, fi->crc[sym.esi]);
+		}
+		/* A recovered one cannot be: some parity symbol was corrupt. */
+		NB_err_if(crc != fi->crc[sym.esi],
+			"esi %"PRIu32" (recovered) CRC 0x%"PRIx32" != 0x%"PRIx32,
+			sym.esi, crc, fi->crc[sym.esi]);
+	} else if (copy_to) {
+		copy_scatter(from, copy_to, psums, psum_cnt, fp->sym_len);
+	} else {
+		xops->scatter(from, psums, psum_cnt, fp->sym_len);
+	}
+	/* a source symbol is now final (unless a receive thread has yet to copy it) */
+	if (fi->sink && sym.esi < fi->cnt.k && !pending)
+		NB_err_if(ffec_sink_done_(fp, fi, sym.esi), "esi %"PRIu32": sink", sym.esi);
 
 	/* See if any row can now be solved.
 	This is done in a separate loop so that we have already removed
@@ -167,11 +593,111 @@ check_recurse:
 		/* reset stack variables */
 		sym.sym = ffec_get_psum(fp, fi, tmp.row);
 		sym.esi = tmp.esi;
+		recovered = 1;
 		goto recurse;
 	}
 
+	/* Peeling is stuck: see if inactivation can finish.
+	It feeds symbols back through this function, which resets 'err_cnt':
+		keep the errors already counted (e.g. a recovered symbol's CRC).
+	*/
+	if ((fi->flags & FFEC_DEC_SOLVE) && fi->cnt.k_decoded < fi->cnt.k) {
+		int errs = err_cnt;
+		NB_die_if(ffec_solve_(fp, fi), "");
+		err_cnt += errs;
+	}
+
 die:
 	if (err_cnt)
 		return -1;
 	return fi->cnt.k - fi->cnt.k_decoded;
 }
+
+
+/*	ffec_dec_prefetch_()
+Prefetch what decoding 'esi' will touch, in 2 stages
+	(its cells must be in cache before they can be followed):
+- stage 0: the column's cells.
+- stage 1: the rows they are linked into, their neighbours in those rows
+	(which unlinking rewrites) and the psums (which are XORed into).
+Prefetching a column which has already been decoded is harmless:
+	its cells are unset and point only to themselves.
+*/
+NLC_INLINE void	ffec_dec_prefetch_	(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					uint32_t			esi,
+					int				stage)
+{
+	if (esi >= fi->cnt.n)
+		return;
+	struct ffec_cell *cell = ffec_get_col_first(fi->cells, esi);
+	if (!stage) {
+		__builtin_prefetch(cell, 1, 3);
+		__builtin_prefetch(&cell[FFEC_N1_DEGREE -1], 1, 3);
+		return;
+	}
+
+	for (unsigned int j=0; j < FFEC_N1_DEGREE; j++) {
+		if (ffec_cell_test(&cell[j]))
+			continue;
+		__builtin_prefetch(&fi->rows[cell[j].row_id], 1, 3);
+		__builtin_prefetch(&fi->cells[cell[j].c_prev], 1, 3);
+		__builtin_prefetch(&fi->cells[cell[j].c_next], 1, 3);
+		if (fi->flags & FFEC_DEC_DEFERRED)
+			continue;
+		/* only the head of the psum: the XOR kernels prefetch the rest */
+		const void *psum = ffec_get_psum(fp, fi, cell[j].row_id);
+		for (uint32_t off=0; off < fp->sym_len && off < FFEC_DEC_PSUM_AHEAD; off += 64)
+			__builtin_prefetch(psum + off, 1, 3);
+	}
+}
+
+
+/*	ffec_decode_batch()
+Decode 'cnt' symbols, e.g. all those received by one recvmmsg().
+Same as calling ffec_decode_sym() on each, except that the matrix
+	cells, rows and psums which the symbols FFEC_DEC_AHEAD
+	further on will touch are prefetched while decoding the current one:
+	in a large block these are all scattered (cache misses),
+	and one symbol at a time there is nothing to overlap them with.
+
+A symbol which fails (e.g. its CRC does not match) does not stop the batch:
+	the others are still decoded.
+
+Returns number of source symbols yet to receive/decode, as ffec_decode_sym().
+Returns '-1' if any symbol failed: see 'fi->cnt' for the number left.
+*/
+uint32_t	ffec_decode_batch	(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					const struct ffec_symbol	*syms,
+					uint32_t			cnt)
+{
+	if (!fp || !fi || (cnt && !syms))
+		return -1;
+
+	int failed = 0;
+	uint32_t left = fi->cnt.k - fi->cnt.k_decoded;
+
+	/* prime the pipeline */
+	for (uint32_t i=0; i < cnt && i < 2 * FFEC_DEC_AHEAD; i++)
+		ffec_dec_prefetch_(fp, fi, syms[i].esi, 0);
+	for (uint32_t i=0; i < cnt && i < FFEC_DEC_AHEAD; i++)
+		ffec_dec_prefetch_(fp, fi, syms[i].esi, 1);
+
+	for (uint32_t i=0; i < cnt && left; i++) {
+		if (i + 2 * FFEC_DEC_AHEAD < cnt)
+			ffec_dec_prefetch_(fp, fi, syms[i + 2 * FFEC_DEC_AHEAD].esi, 0);
+		if (i + FFEC_DEC_AHEAD < cnt)
+			ffec_dec_prefetch_(fp, fi, syms[i + FFEC_DEC_AHEAD].esi, 1);
+
+		uint32_t ret = ffec_decode_sym(fp, fi, syms[i]);
+		if (ret == (uint32_t)-1)
+			failed = 1;
+		else
+			left = ret;
+	}
+
+	if (failed)
+		return -1;
+	return left;
+}
@@ -1,11 +1,44 @@
 /*	ffec_encode.c
-
-TODO:
--	Encode a single symbol
--	Encode a range of symbols
 */
 
 #include <ffec_internal.h>
+#include <pthread.h>
+
+
+/* Encode row-major (see ffec_enc_mode_get_()) if the parity region
+	is larger than this many Bytes: once it no longer fits in
+	the last-level cache, so that scattering into it misses on every XOR.
+Set well above common LLC sizes: while the parity region is (even mostly)
+	cached, column-major is faster, since it reads each source symbol once.
+Tune for the target machine at build time.
+*/
+#ifndef FFEC_ENC_GATHER_MIN
+	#define FFEC_ENC_GATHER_MIN (256UL << 20)
+#endif
+
+/* Encode tiled (see ffec_enc_tile_()) if the parity region is larger
+	than this many Bytes (but below FFEC_ENC_GATHER_MIN).
+Off unless set at build time: so far, with the parity region in DRAM,
+	column-major has still beaten tiled on the machines measured,
+	since tiled reads each source symbol up to FFEC_N1_DEGREE times
+	(see benchmark/meson.build).
+*/
+#ifndef FFEC_ENC_TILE_MIN
+	#define FFEC_ENC_TILE_MIN SIZE_MAX
+#endif
+/* tile size, in Bytes: about half of a typical L2,
+	leaving room for the source symbols streaming through it
+*/
+#ifndef FFEC_ENC_TILE_LEN
+	#define FFEC_ENC_TILE_LEN (1UL << 20)
+#endif
+/* tiled: number of source cells ahead to prefetch */
+#ifndef FFEC_ENC_TILE_AHEAD
+	#define FFEC_ENC_TILE_AHEAD 2
+#endif
+
+/* max number of symbols XORed by one call to the gather kernel */
+#define FFEC_ENC_GATHER_CNT 16
 
 
 /*	ffec_sym_p_()
@@ -37,10 +70,360 @@ NLC_INLINE const void	*ffec_sym_n_	(const struct ffec_params	*fp,
 }
 
 
+/*	ffec_stair_()
+Get address of the staircase ring entry for parity symbol 'p'.
+The ring holds the last (FFEC_N1_DEGREE -1) parity symbols finalized,
+	so that they can be read back without touching the parity region.
+NOTE: this NOT 'esi', this is 'esi - k'
+*/
+NLC_INLINE void	*ffec_stair_		(const struct ffec_params	*fp,
+					const struct ffec_instance	*fi,
+					uint32_t			p)
+{
+	return fi->stair + (fp->sym_len * (p % (FFEC_N1_DEGREE -1)));
+}
+
+
+/*	ffec_enc_stair_()
+Resolve the staircase for parity symbol 'row':
+	XOR into it the (up to) FFEC_N1_DEGREE -1 parity symbols preceding it,
+	which MUST already be final.
+This is equivalent to XORing each parity column into the rows below it,
+	but writes each parity symbol only once.
+
+With FFEC_NT_STORE the parity symbol is written with streaming stores:
+	its predecessors are then read from (and it is written to)
+	the staircase ring, which stays in cache.
+*/
+NLC_INLINE void	ffec_enc_stair_		(const struct ffec_params	*fp,
+					const struct ffec_instance	*fi,
+					uint32_t			row)
+{
+	const void *from[FFEC_N1_DEGREE];
+	uint32_t cnt = 0;
+	void *to = ffec_sym_p_(fp, fi, row);
+
+	/* j=0 is the parity symbol itself: accumulate into it */
+	from[cnt++] = to;
+
+	if (fi->flags & FFEC_NT_STORE) {
+		for (uint32_t j=1; j < FFEC_N1_DEGREE && j <= row; j++)
+			from[cnt++] = ffec_stair_(fp, fi, row - j);
+		/* ring entry for 'row' is the one of 'row - (FFEC_N1_DEGREE -1)':
+			gather reads all sources before writing.
+		*/
+		fi->xops->gather_nt(from, cnt, to, ffec_stair_(fp, fi, row), fp->sym_len);
+
+	} else {
+		for (uint32_t j=1; j < FFEC_N1_DEGREE && j <= row; j++)
+			from[cnt++] = ffec_sym_p_(fp, fi, row - j);
+		if (cnt < 2)
+			return;
+		fi->xops->gather(from, cnt, to, fp->sym_len);
+	}
+
+	NB_wrn("stair(p%"PRIu32") <- %"PRIu32" parity", row, cnt -1);
+}
+
+
+/*	ffec_enc_rows_()
+Zero parity symbols 'first' to 'last' (exclusive),
+	then XOR into them every source symbol which has a cell in those rows.
+Only source columns: the staircase is resolved afterwards (see ffec_enc_stair_()).
+
+Source symbols are read SEQUENTIALLY,
+	limiting the pattern of random memory access to the repair symbols.
+Rows are disjoint between callers, so that several threads may run this
+	at once without any locking.
+With FFEC_CRC, the CRC of a source symbol is computed by the caller
+	owning the row of its first cell.
+*/
+static void	ffec_enc_rows_		(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					uint32_t			first,
+					uint32_t			last)
+{
+	memset(ffec_sym_p_(fp, fi, first), 0x0, (size_t)(last - first) * fp->sym_len);
+
+	/* Note that the scatter kernel issues prefetch instructions,
+		don't duplicate that here.
+	*/
+	for (int64_t i=0; i < fi->cnt.k; i++) {
+		const uint32_t *rows = ffec_enc_col(fi, i);
+		const void *symbol = ffec_sym_n_(fp, fi, i);
+
+		/* parity symbol for each row in range */
+		void *to[FFEC_N1_DEGREE];
+		uint32_t cnt = 0;
+		for (uint32_t j=0; j < FFEC_N1_DEGREE; j++) {
+			if (rows[j] < first || rows[j] >= last)
+				continue;
+			to[cnt++] = ffec_sym_p_(fp, fi, rows[j]);
+			NB_wrn("xor(esi %"PRId64") -> p%"PRIu32" @0x%"PRIxPTR,
+				i, rows[j], (uintptr_t)to[cnt-1]);
+		}
+
+		/* read source symbol once, XOR into all of them */
+		if ((fi->flags & FFEC_CRC)
+			&& rows[0] >= first && rows[0] < last)
+		{
+			fi->crc[i] = fi->xops->scatter_crc(symbol, NULL, to,
+						cnt, fp->sym_len, 0);
+		} else if (cnt) {
+			fi->xops->scatter(symbol, to, cnt, fp->sym_len);
+		}
+	}
+}
+
+
+/*	ffec_enc_csr_
+Source cells bucketed by parity row, for row-major and tiled encode:
+	the cells in rows 'b * rows' to '(b+1) * rows' (exclusive) are
+	'ids[first[b]]' to 'ids[first[b+1]]' (exclusive), in ascending order:
+	so in column order, the cells of one column being adjacent.
+Walking the row linked lists directly chases a pointer into a random cell
+	for every source symbol; this is read sequentially instead.
+*/
+struct ffec_enc_csr_ {
+	uint32_t	rows;	/* rows per bucket: 1 for row-major */
+	uint32_t	cnt;	/* number of buckets */
+	uint32_t	*first;	/* cnt +1 */
+	uint32_t	*ids;	/* k * FFEC_N1_DEGREE */
+};
+
+/*	ffec_enc_csr_free_()
+*/
+static void	ffec_enc_csr_free_	(struct ffec_enc_csr_		*csr)
+{
+	free(csr->first);
+	free(csr->ids);
+	csr->first = csr->ids = NULL;
+}
+
+/*	ffec_enc_csr_new_()
+Counting sort of source cells by bucket: two sequential passes over the cells.
+returns 0 on success
+*/
+static int	ffec_enc_csr_new_	(const struct ffec_instance	*fi,
+					struct ffec_enc_csr_		*csr,
+					uint32_t			rows)
+{
+	int err_cnt = 0;
+	const uint32_t cell_cnt = fi->cnt.k * FFEC_N1_DEGREE;
+	csr->rows = rows;
+	csr->cnt = nm_div_ceil(fi->cnt.p, rows);
+
+	NB_die_if(!(
+		csr->first = calloc(csr->cnt +1, sizeof(uint32_t))
+		), "calloc(%"PRIu32", %zu)", csr->cnt +1, sizeof(uint32_t));
+	NB_die_if(!(
+		csr->ids = malloc(cell_cnt * sizeof(uint32_t))
+		), "malloc(%zu)", cell_cnt * sizeof(uint32_t));
+
+	/* count; then running sum: 'first[b]' is the END of bucket 'b' */
+	for (uint32_t i=0; i < cell_cnt; i++)
+		csr->first[fi->col_rows[i] / rows]++;
+	for (uint32_t b=1; b <= csr->cnt; b++)
+		csr->first[b] += csr->first[b-1];
+	/* fill backwards: 'first[b]' ends up at the START of bucket 'b' */
+	for (uint32_t i=cell_cnt; i > 0; i--)
+		csr->ids[--csr->first[fi->col_rows[i-1] / rows]] = i-1;
+
+	return 0;
+die:
+	ffec_enc_csr_free_(csr);
+	return err_cnt;
+}
+
+
+/*	ffec_enc_gather_row_()
+Row-major encode of parity symbol 'row':
+	gather all source symbols in its row
+	and, if 'stair', the FFEC_N1_DEGREE -1 parity symbols preceding it
+	(which MUST already be final),
+	and write the result exactly once.
+Without 'stair' the staircase must be resolved afterwards (see ffec_enc_stair_()).
+
+Sources are gathered at most FFEC_ENC_GATHER_CNT at a time;
+	the partial result is accumulated in the parity symbol
+	or, with FFEC_NT_STORE, in its staircase ring entry (which stays in cache)
+	so that the parity symbol is streamed out only once, at the end.
+*/
+NLC_INLINE void	ffec_enc_gather_row_	(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					const struct ffec_enc_csr_	*csr,
+					uint32_t			row,
+					int				stair)
+{
+	const int nt = stair && (fi->flags & FFEC_NT_STORE);
+	void *to = ffec_sym_p_(fp, fi, row);
+	/* ring entry for 'row' is the one of 'row - (FFEC_N1_DEGREE -1)':
+		it is only written after being read by the first gather.
+	*/
+	void *acc = nt ? ffec_stair_(fp, fi, row) : to;
+	const void *from[FFEC_ENC_GATHER_CNT];
+	uint32_t cnt = 0;
+
+	if (stair) {
+		for (uint32_t j=1; j < FFEC_N1_DEGREE && j <= row; j++)
+			from[cnt++] = nt ? ffec_stair_(fp, fi, row - j) : ffec_sym_p_(fp, fi, row - j);
+	}
+
+	for (uint32_t i = csr->first[row]; i < csr->first[row +1]; i++) {
+		uint32_t col = csr->ids[i] / FFEC_N1_DEGREE;
+		const void *symbol = ffec_sym_n_(fp, fi, col);
+
+		/* CRC is computed in the row of the column's first cell:
+			symbol is then cache-hot for the gather.
+		*/
+		if ((fi->flags & FFEC_CRC) && !(csr->ids[i] % FFEC_N1_DEGREE)) {
+			fi->crc[col] = fi->xops->scatter_crc(symbol, NULL, NULL, 0,
+								fp->sym_len, 0);
+		}
+
+		if (cnt == FFEC_ENC_GATHER_CNT) {
+			fi->xops->gather(from, cnt, acc, fp->sym_len);
+			cnt = 0;
+			from[cnt++] = acc;
+		}
+		from[cnt++] = symbol;
+	}
+
+	if (nt)
+		fi->xops->gather_nt(from, cnt, to, acc, fp->sym_len);
+	else
+		fi->xops->gather(from, cnt, to, fp->sym_len);
+}
+
+
+/*	ffec_enc_tile_()
+Tiled encode of the parity rows in bucket 'b' (a tile):
+	zero them, then scatter into them each source symbol with a cell
+	in the tile, in column order.
+A tile is sized to stay in L2 (see FFEC_ENC_TILE_LEN) while all of its
+	sources are applied; the price is that a source symbol is read once
+	per tile it has cells in (up to FFEC_N1_DEGREE times),
+	though still in ascending order.
+If 'stair', the staircase of the tile's rows is resolved while they are
+	still in cache: tiles MUST then be encoded in order.
+*/
+NLC_INLINE void	ffec_enc_tile_		(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					const struct ffec_enc_csr_	*csr,
+					uint32_t			b,
+					int				stair)
+{
+	const uint32_t first = b * csr->rows;
+	const uint32_t last = (fi->cnt.p - first > csr->rows) ? first + csr->rows : fi->cnt.p;
+	memset(ffec_sym_p_(fp, fi, first), 0x0, (size_t)(last - first) * fp->sym_len);
+
+	for (uint32_t i = csr->first[b]; i < csr->first[b +1]; ) {
+		uint32_t col = csr->ids[i] / FFEC_N1_DEGREE;
+		const void *symbol = ffec_sym_n_(fp, fi, col);
+		int crc = 0;
+
+		/* Source symbols are scattered in memory: hardware prefetch
+			only kicks in well into each one.
+		Fetch a symbol further on entirely, so that several are in flight.
+		*/
+		if (i + FFEC_ENC_TILE_AHEAD < csr->first[b +1]) {
+			const void *next = ffec_sym_n_(fp, fi,
+				csr->ids[i + FFEC_ENC_TILE_AHEAD] / FFEC_N1_DEGREE);
+			for (uint32_t off=0; off < fp->sym_len; off += 64)
+				__builtin_prefetch(next + off, 0, 0);
+		}
+
+		/* all cells of this column in the tile */
+		void *to[FFEC_N1_DEGREE];
+		uint32_t cnt = 0;
+		for (; i < csr->first[b +1] && csr->ids[i] / FFEC_N1_DEGREE == col; i++) {
+			to[cnt++] = ffec_sym_p_(fp, fi, fi->col_rows[csr->ids[i]]);
+			crc |= !(csr->ids[i] % FFEC_N1_DEGREE);
+		}
+
+		/* CRC is computed in the tile of the column's first cell */
+		if (crc && (fi->flags & FFEC_CRC))
+			fi->crc[col] = fi->xops->scatter_crc(symbol, NULL, to,
+						cnt, fp->sym_len, 0);
+		else
+			fi->xops->scatter(symbol, to, cnt, fp->sym_len);
+	}
+
+	if (stair) {
+		for (uint32_t r=first; r < last; r++)
+			ffec_enc_stair_(fp, fi, r);
+	}
+}
+
+
+/*	ffec_enc_mode_
+How to encode: see ffec_enc_mode_get_().
+*/
+enum ffec_enc_mode_ {
+	FFEC_ENC_M_SCATTER,	/* column-major */
+	FFEC_ENC_M_TILED,	/* column-major, one tile of parity rows at a time */
+	FFEC_ENC_M_GATHER	/* row-major */
+};
+
+/*	ffec_enc_mode_get_()
+Column-major reads each source symbol once, sequentially,
+	but XORs it into FFEC_N1_DEGREE random parity symbols:
+	cheap while the parity region fits in cache,
+	a cache-missing read-modify-write per XOR once it doesn't.
+Tiled keeps parity XORs in L2 by reading each source symbol
+	up to FFEC_N1_DEGREE times, in ascending order.
+Row-major writes each parity symbol once, but reads each source symbol
+	FFEC_N1_DEGREE times, in random order.
+*/
+NLC_INLINE enum ffec_enc_mode_ ffec_enc_mode_get_(const struct ffec_instance *fi)
+{
+	if (fi->flags & FFEC_ENC_GATHER)
+		return FFEC_ENC_M_GATHER;
+	if (fi->flags & FFEC_ENC_TILED)
+		return FFEC_ENC_M_TILED;
+	if (fi->flags & FFEC_ENC_SCATTER)
+		return FFEC_ENC_M_SCATTER;
+	if (fi->parity_len > FFEC_ENC_GATHER_MIN)
+		return FFEC_ENC_M_GATHER;
+	if (fi->parity_len > FFEC_ENC_TILE_MIN)
+		return FFEC_ENC_M_TILED;
+	return FFEC_ENC_M_SCATTER;
+}
+
+/*	ffec_enc_csr_rows_()
+Rows per bucket of the index for 'mode'.
+*/
+NLC_INLINE uint32_t ffec_enc_csr_rows_	(const struct ffec_params	*fp,
+					enum ffec_enc_mode_		mode)
+{
+	if (mode == FFEC_ENC_M_GATHER || fp->sym_len >= FFEC_ENC_TILE_LEN)
+		return 1;
+	return FFEC_ENC_TILE_LEN / fp->sym_len;
+}
+
+/*	ffec_enc_buckets_()
+Encode buckets 'first' to 'last' (exclusive) of 'csr' in 'mode':
+	tiles, or single rows if row-major.
+*/
+static void	ffec_enc_buckets_	(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					enum ffec_enc_mode_		mode,
+					const struct ffec_enc_csr_	*csr,
+					uint32_t			first,
+					uint32_t			last,
+					int				stair)
+{
+	for (uint32_t b=first; b < last; b++) {
+		if (mode == FFEC_ENC_M_GATHER)
+			ffec_enc_gather_row_(fp, fi, csr, b, stair);
+		else
+			ffec_enc_tile_(fp, fi, csr, b, stair);
+	}
+}
+
+
 /*	ffec_encode()
 Go through an entire block and generate its repair symbols.
-The main emphasis is on SEQUENTIALLY accessing source symbols,
-	limiting the pattern of random memory access to the repair symbols.
 
 return 0 on success
 */
@@ -50,36 +433,352 @@ uint32_t	ffec_encode	(const struct ffec_params	*fp,
 	int err_cnt = 0;
 	NB_die_if(!fi, "args");
 
-	/* zero out all parity symbols */
-	memset(fi->parity, 0x0, fi->cnt.p * fp->sym_len);
+	enum ffec_enc_mode_ mode = ffec_enc_mode_get_(fi);
+	if (mode != FFEC_ENC_M_SCATTER) {
+		struct ffec_enc_csr_ csr;
+		NB_die_if(ffec_enc_csr_new_(fi, &csr, ffec_enc_csr_rows_(fp, mode)), "");
+		ffec_enc_buckets_(fp, fi, mode, &csr, 0, csr.cnt, 1);
+		ffec_enc_csr_free_(&csr);
+		goto die;
+	}
 
-	for (int64_t i=0; i < fi->cnt.cols; i++) {
-		/* get source symbol
-		Note that ffec_xor_into_symbol_() issues prefetch instructions,
-			don't duplicate that here.
-		*/
-		struct ffec_cell *cell = ffec_get_col_first(fi->cells, i);
-		const void *symbol = ffec_sym_n_(fp, fi, i);
-		NB_wrn("enc(esi %"PRIu64") @0x%"PRIxPTR,
-			i, (uintptr_t)symbol);
+	ffec_enc_rows_(fp, fi, 0, fi->cnt.p);
 
-		for (uint32_t j=0; j < FFEC_N1_DEGREE; j++) {
-			/* avoid empty cells under the staircase */
-			if (ffec_cell_test(&cell[j]))
-				continue;
-			/* Avoid XOR-ing parity symbol with itself */
-			if (i - fi->cnt.k == cell[j].row_id)
-				continue;
-			/* XOR into parity symbol for that row */
-			ffec_xor_into_symbol_(symbol,
-					ffec_sym_p_(fp, fi, cell[j].row_id),
-					fp->sym_len);
-			NB_wrn("xor(esi %"PRId64") -> p%"PRIu32" @0x%"PRIxPTR,
-				i, cell[j].row_id,
-				(uintptr_t)ffec_sym_p_(fp, fi, cell[j].row_id));
-		}
+	/* Parity columns: in order, since each parity symbol depends
+		on the ones before it.
+	*/
+	for (uint32_t r=0; r < fi->cnt.p; r++)
+		ffec_enc_stair_(fp, fi, r);
+
+die:
+	return err_cnt;
+}
+
+
+/*	ffec_enc_thread_
+One thread of ffec_encode_mt(): owns parity rows 'first' to 'last' (exclusive);
+	or, if tiled or row-major, buckets of 'csr'.
+*/
+struct ffec_enc_thread_ {
+	const struct ffec_params	*fp;
+	struct ffec_instance		*fi;
+	uint32_t			first;
+	uint32_t			last;
+	enum ffec_enc_mode_		mode;
+	const struct ffec_enc_csr_	*csr;	/* NULL if column-major */
+	pthread_t			tid;
+	int				started;
+};
+
+/*	ffec_enc_thread_run_()
+*/
+static void	*ffec_enc_thread_run_	(void *arg)
+{
+	struct ffec_enc_thread_ *et = arg;
+	if (et->csr)
+		ffec_enc_buckets_(et->fp, et->fi, et->mode, et->csr, et->first, et->last, 0);
+	else
+		ffec_enc_rows_(et->fp, et->fi, et->first, et->last);
+	return NULL;
+}
+
+
+/*	ffec_encode_mt()
+As ffec_encode(), but split over 'threads' threads (including the caller's).
+
+Each thread owns a disjoint range of parity rows and scans all source columns,
+	XORing only into its own rows: no atomics or locks on parity symbols.
+The price is that a source symbol is read by every thread owning one
+	of its rows (up to FFEC_N1_DEGREE of them);
+	so this scales until memory bandwidth saturates.
+Tiled or row-major (see ffec_enc_mode_get_()), threads simply encode
+	their own tiles or rows.
+The staircase is then resolved by the calling thread alone,
+	since each parity symbol depends on the ones before it.
+
+A thread which cannot be started has its rows encoded by the caller.
+
+return 0 on success
+*/
+uint32_t	ffec_encode_mt	(const struct ffec_params	*fp,
+				struct ffec_instance		*fi,
+				unsigned int			threads)
+{
+	int err_cnt = 0;
+	struct ffec_enc_thread_ *et = NULL;
+	struct ffec_enc_csr_ csr = { 0 };
+	NB_die_if(!fi, "args");
+
+	enum ffec_enc_mode_ mode = ffec_enc_mode_get_(fi);
+	/* at least one bucket (row or tile) per thread */
+	uint32_t buckets = fi->cnt.p;
+	if (mode != FFEC_ENC_M_SCATTER)
+		buckets = nm_div_ceil(fi->cnt.p, ffec_enc_csr_rows_(fp, mode));
+	if (threads > buckets)
+		threads = buckets;
+	if (threads < 2)
+		return ffec_encode(fp, fi);
+
+	NB_die_if(!(
+		et = calloc(threads, sizeof(*et))
+		), "calloc(%u, %zu)", threads, sizeof(*et));
+	if (mode != FFEC_ENC_M_SCATTER)
+		NB_die_if(ffec_enc_csr_new_(fi, &csr, ffec_enc_csr_rows_(fp, mode)), "");
+	for (unsigned int t=0; t < threads; t++) {
+		et[t].fp = fp;
+		et[t].fi = fi;
+		et[t].mode = mode;
+		et[t].csr = csr.first ? &csr : NULL;
+		et[t].first = (uint64_t)buckets * t / threads;
+		et[t].last = (uint64_t)buckets * (t+1) / threads;
+	}
+
+	/* thread 0 is the caller */
+	for (unsigned int t=1; t < threads; t++) {
+		et[t].started = !pthread_create(&et[t].tid, NULL, ffec_enc_thread_run_, &et[t]);
+		NB_wrn_if(!et[t].started, "thread %u not started: running inline", t);
+	}
+	ffec_enc_thread_run_(&et[0]);
+	for (unsigned int t=1; t < threads; t++) {
+		if (et[t].started)
+			pthread_join(et[t].tid, NULL);
+		else
+			ffec_enc_thread_run_(&et[t]);
 	}
 
+	for (uint32_t r=0; r < fi->cnt.p; r++)
+		ffec_enc_stair_(fp, fi, r);
+
 die:
+	ffec_enc_csr_free_(&csr);
+	free(et);
 	return err_cnt;
 }
+
+
+/*	ffec_enc_fold_()
+Incremental encode of source symbol 'esi', read from 'from':
+	XOR it into its parity symbols, and count it out of their rows.
+Parity symbols are NOT final until released (see ffec_enc_release_()).
+*/
+NLC_INLINE void	ffec_enc_fold_		(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					uint32_t			esi,
+					const void			*from)
+{
+	const uint32_t *rows = ffec_enc_col(fi, esi);
+
+	/* parity is only zeroed once the first symbol is in hand:
+		the caller may be producing it in the meantime.
+	*/
+	if (!fi->cnt.k_encoded) {
+		memset(fi->parity, 0x0, fi->parity_len);
+		for (uint32_t i=0; i < fi->cnt.k * FFEC_N1_DEGREE; i++)
+			fi->row_cnt[fi->col_rows[i]]++;
+	}
+
+	/* caller's buffer may not be aligned, even if the matrix is */
+	const struct ffec_xor_ops *xops = fi->xops;
+	if (fi->aligned && ((uintptr_t)from % FFEC_SYM_ALIGN))
+		xops = ffec_xor_ops_(fp->sym_len, 0);
+
+	void *to[FFEC_N1_DEGREE];
+	for (uint32_t j=0; j < FFEC_N1_DEGREE; j++) {
+		to[j] = ffec_sym_p_(fp, fi, rows[j]);
+		fi->row_cnt[rows[j]]--;
+		NB_wrn("xor(esi %"PRIu32") -> p%"PRIu32" @0x%"PRIxPTR,
+			esi, rows[j], (uintptr_t)to[j]);
+	}
+	ffec_enc_done_set(fi, esi);
+
+	if (fi->flags & FFEC_CRC)
+		fi->crc[esi] = xops->scatter_crc(from, NULL, to,
+					FFEC_N1_DEGREE, fp->sym_len, 0);
+	else
+		xops->scatter(from, to, FFEC_N1_DEGREE, fp->sym_len);
+
+	fi->cnt.k_encoded++;
+}
+
+/*	ffec_enc_release_()
+Finalize every parity symbol which can be, in order:
+	a row is complete once all of its source symbols are in,
+	and its parity symbol is final once its staircase is resolved,
+	which needs all the ones before it to be final.
+Each row is looked at once per call, plus once when it is released:
+	negligible next to the XORs.
+Nothing can be released before the first fold, which sets up 'row_cnt'
+	(see ffec_enc_fold_()): until then, every row looks complete.
+*/
+NLC_INLINE void	ffec_enc_release_	(const struct ffec_params	*fp,
+					struct ffec_instance		*fi)
+{
+	if (!fi->cnt.k_encoded)
+		return;
+	uint32_t r = fi->cnt.p_encoded;
+	for (; r < fi->cnt.p && !fi->row_cnt[r]; r++)
+		ffec_enc_stair_(fp, fi, r);
+	fi->cnt.p_encoded = r;
+}
+
+
+/*	ffec_encode_sym()
+Encode incrementally: XOR one source symbol into its parity symbols
+	as soon as the caller has produced it, in any order.
+Parity symbols are final as soon as all their source symbols are in
+	(see ffec_encode_range());
+	once the last source symbol is in, the whole parity region is.
+
+'sym.sym' is read instead of the source region passed to ffec_new(),
+	unless it is NULL; either way the symbol SHOULD also be
+	in the source region by the time it is sent (see ffec_enc_seq()).
+
+A symbol given twice is ignored (see ffec_test_esi()).
+'row_cnt' holds the number of source symbols each row is still missing.
+
+Do not mix with ffec_encode() on the same instance.
+
+Returns number of source symbols yet to be given.
+A return of '0' means "all parity symbols complete".
+Returns '-1' on error.
+*/
+uint32_t	ffec_encode_sym		(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					struct ffec_symbol		sym)
+{
+	int err_cnt = 0;
+	NB_die_if(!fp || !fi || !fi->enc_source, "args");
+	NB_die_if(sym.esi >= fi->cnt.k, "esi %"PRIu32" not a source symbol", sym.esi);
+
+	if (ffec_test_esi(fi, sym.esi))
+		goto die;
+	ffec_enc_fold_(fp, fi, sym.esi,
+		sym.sym ? sym.sym : ffec_sym_n_(fp, fi, sym.esi));
+	ffec_enc_release_(fp, fi);
+
+die:
+	if (err_cnt)
+		return -1;
+	return fi->cnt.k - fi->cnt.k_encoded;
+}
+
+
+/*	ffec_encode_range()
+Encode incrementally: source symbols 'first' to 'last' (exclusive),
+	read from the source region passed to ffec_new(), in order.
+Symbols already given (here or to ffec_encode_sym()) are skipped.
+
+Parity symbols 0 to the returned count (exclusive) are final, and may be
+	sent right away: encoding a block in consecutive ranges, the first
+	parity symbols are released long before the last source symbol is in.
+NOTE that because of the staircase, parity symbols are released in order.
+By default each row draws its source symbols from the whole block,
+	so almost every row has one in the last few percent of it:
+	parity is then released only at the end.
+With a matrix 'window' (see ffec_params), parity is released
+	a couple of windows behind the source.
+
+Do not mix with ffec_encode() on the same instance.
+
+Returns the number of parity symbols which are final
+	('cnt.p' once all source symbols are in).
+Returns '-1' on error.
+*/
+uint32_t	ffec_encode_range	(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					uint32_t			first,
+					uint32_t			last)
+{
+	int err_cnt = 0;
+	NB_die_if(!fp || !fi || !fi->enc_source, "args");
+	NB_die_if(first > last || last > fi->cnt.k,
+		"range %"PRIu32"-%"PRIu32" of k=%"PRIu32, first, last, fi->cnt.k);
+
+	for (uint32_t i=first; i < last; i++) {
+		if (!ffec_test_esi(fi, i))
+			ffec_enc_fold_(fp, fi, i, ffec_sym_n_(fp, fi, i));
+	}
+	ffec_enc_release_(fp, fi);
+
+die:
+	if (err_cnt)
+		return -1;
+	return fi->cnt.p_encoded;
+}
+
+
+/*	ffec_enc_free_()
+Free encode state not in the ffec_new() memory region; called by ffec_free().
+*/
+void		ffec_enc_free_		(struct ffec_instance		*fi)
+{
+	if (!fi->enc_csr)
+		return;
+	ffec_enc_csr_free_(fi->enc_csr);
+	free(fi->enc_csr);
+	fi->enc_csr = NULL;
+}
+
+
+/*	ffec_enc_lazy()
+As ffec_enc_seq(), but parity symbols are computed on demand,
+	the first time they are asked for:
+	source symbols can be sent right away, without any startup encode.
+Parity symbols are gathered row-major (see ffec_enc_gather_row_())
+	and written once, the CRCs (FFEC_CRC) of their sources with them.
+
+Because of the staircase, a parity symbol can only be computed after
+	all those before it: in the shuffled sequence, the first few parity
+	symbols sent already cost most of the encode.
+With FFEC_ENC_LAZY_SORT, the parity ESIs in 'esi_seq' are put in ascending
+	order on the first call: the sequence still has source and parity symbols
+	at the same (random) positions, but each parity symbol costs one row,
+	spreading encode evenly over the transmit window.
+	ffec_enc_seq() gives the same sequence thereafter.
+	At 10% FEC this took decode inefficiency from ~1.018 to 1.015-1.06.
+
+'fi->crc' is only complete once all parity symbols have been asked for.
+Do not mix with ffec_encode() or ffec_encode_sym() on the same instance.
+
+Returns a symbol with 'sym' NULL on error.
+*/
+struct ffec_symbol	ffec_enc_lazy	(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					uint32_t			i)
+{
+	int err_cnt = 0;
+	struct ffec_symbol ret = { 0 };
+	NB_die_if(!fp || !fi || !fi->enc_source, "args");
+	NB_die_if(i >= fi->cnt.n, "symbol %"PRIu32" of n=%"PRIu32, i, fi->cnt.n);
+
+	/* first call */
+	if (!fi->cnt.p_encoded && !fi->enc_csr) {
+		NB_die_if(!(
+			fi->enc_csr = calloc(1, sizeof(*fi->enc_csr))
+			), "calloc(1, %zu)", sizeof(*fi->enc_csr));
+		NB_die_if(ffec_enc_csr_new_(fi, fi->enc_csr, 1), "");
+
+		if (fi->flags & FFEC_ENC_LAZY_SORT) {
+			for (uint32_t j=0, r=0; j < fi->cnt.n; j++) {
+				if (fi->esi_seq[j] >= fi->cnt.k)
+					fi->esi_seq[j] = fi->cnt.k + r++;
+			}
+		}
+	}
+
+	ret = ffec_enc_seq(fp, fi, i);
+	if (ret.esi >= fi->cnt.k && ret.esi - fi->cnt.k >= fi->cnt.p_encoded) {
+		uint32_t r = ret.esi - fi->cnt.k;
+		for (; fi->cnt.p_encoded <= r; fi->cnt.p_encoded++)
+			ffec_enc_gather_row_(fp, fi, fi->enc_csr, fi->cnt.p_encoded, 1);
+		/* index no longer needed */
+		if (fi->cnt.p_encoded == fi->cnt.p)
+			ffec_enc_free_(fi);
+	}
+
+	return ret;
+die:
+	ffec_enc_free_(fi);
+	ret.sym = NULL;
+	return ret;
+}
@@ -0,0 +1,198 @@
+/*	ffec_ingest.c
+
+Decode fed by several receive threads.
+
+The decoder proper (ffec_decode_sym()) walks and rewrites the whole matrix,
+	so it stays single-threaded: it is the one consumer.
+What scales with the number of receive threads is everything before it:
+	the copy of each received symbol into the matrix (and its CRC check),
+	done by whichever thread received it (ffec_ingest()).
+The consumer then only sees the ESIs, through a lock-free queue,
+	and decodes them in place (ffec_ingest_drain()).
+
+A symbol may be both received and recovered (by decoding) at the same time:
+	whoever claims the ESI first (see ffec_ingest_claim_()) owns its slot
+	in the matrix, the other one never writes it.
+*/
+
+#include <ffec_internal.h>
+
+
+/* ffec_ingest_drain(): ESIs handed to ffec_decode_batch() at a time */
+#ifndef FFEC_INGEST_BATCH
+	#define FFEC_INGEST_BATCH 64
+#endif
+
+
+/*	ffec_ingest_init()
+Set up a DECODE instance for ffec_ingest().
+Must be called before any receive thread is started.
+Receive threads copy parity symbols into their blocks:
+	the psums are moved out of them (see ffec_psums_own_()).
+returns 0 on success
+*/
+int		ffec_ingest_init(const struct ffec_params	*fp,
+				struct ffec_instance		*fi)
+{
+	int err_cnt = 0;
+	NB_die_if(!fp || !fi, "args");
+	NB_die_if(!fi->dec_source, "not a decode instance");
+	NB_die_if(fi->ingest, "already set up");
+	NB_die_if(fi->flags & FFEC_DEC_DEFERRED, "not with FFEC_DEC_DEFERRED");
+	NB_die_if(fi->rx, "not with ffec_rx_init()");
+	NB_die_if(ffec_psums_own_(fp, fi), "");
+
+	const size_t words = (fi->cnt.n + 63) / 64;
+	NB_die_if(!(
+		fi->ingest = calloc(1, sizeof(*fi->ingest))
+		), "");
+	NB_die_if(!(
+		fi->ingest->claimed = calloc(words, sizeof(uint64_t))
+		), "");
+	NB_die_if(!(
+		fi->ingest->drained = calloc(words, sizeof(uint64_t))
+		), "");
+	NB_die_if(!(
+		fi->ingest->waiting = calloc(words, sizeof(uint64_t))
+		), "");
+	NB_die_if(!(
+		fi->ingest->ring = calloc(fi->cnt.n, sizeof(uint32_t))
+		), "");
+
+	/* symbols already decoded are in the matrix: nothing to copy */
+	for (uint32_t esi=0; esi < fi->cnt.n; esi++) {
+		if (ffec_test_esi(fi, esi))
+			fi->ingest->claimed[esi / 64] |= 1ULL << (esi % 64);
+	}
+
+	return 0;
+die:
+	ffec_ingest_free_(fi);
+	return err_cnt;
+}
+
+
+/*	ffec_ingest()
+Receive side, any thread: copy a received symbol into the matrix
+	and queue it for ffec_ingest_drain().
+Thread-safe: any number of threads may call this concurrently,
+	alongside one thread calling ffec_ingest_drain().
+With FFEC_CRC, source symbols are checked here (before touching the matrix),
+	not when drained.
+
+Returns 0 if queued, 1 if dropped because this ESI was already received
+	or decoded, -1 if 'sym' is invalid or corrupt.
+*/
+int		ffec_ingest	(const struct ffec_params	*fp,
+				struct ffec_instance		*fi,
+				struct ffec_symbol		sym)
+{
+	/* called concurrently: don't use the shared error count */
+	int err_cnt = 0;
+	NB_die_if(!fp || !fi || !fi->ingest || !sym.sym, "args");
+	NB_die_if(sym.esi >= fi->cnt.n, "esi %"PRIu32" >= n %"PRIu32, sym.esi, fi->cnt.n);
+	struct ffec_ingest_ *ing = fi->ingest;
+
+	/* cheap check for duplicates before reading the symbol */
+	if ((__atomic_load_n(&ing->claimed[sym.esi / 64], __ATOMIC_RELAXED)
+			>> (sym.esi % 64)) & 0x1)
+		return 1;
+
+	if ((fi->flags & FFEC_CRC) && sym.esi < fi->cnt.k) {
+		uint32_t crc = ffec_crc32c(sym.sym, fp->sym_len);
+		NB_die_if(crc != fi->crc[sym.esi],
+			"esi %"PRIu32" (received) CRC 0x%"PRIx32" != 0x%"PRIx32,
+			sym.esi, crc, fi->crc[sym.esi]);
+	}
+
+	if (!ffec_ingest_claim_(ing, sym.esi))
+		return 1;
+
+	const struct ffec_xor_ops *xops = fi->xops;
+	if (fi->aligned && ((uintptr_t)sym.sym % FFEC_SYM_ALIGN))
+		xops = ffec_xor_ops_(fp->sym_len, 0);
+	void *to = fi->dec_source + ((size_t)fp->sym_len * sym.esi);
+	if (fi->flags & FFEC_NT_STORE)
+		xops->copy_scatter_nt(sym.sym, to, NULL, 0, fp->sym_len);
+	else
+		xops->copy_scatter(sym.sym, to, NULL, 0, fp->sym_len);
+
+	/* Publish: the release store orders the copy above before it.
+	Every ESI is claimed once, so 'slot' is always < n.
+	*/
+	uint32_t slot = __atomic_fetch_add(&ing->tail, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&ing->ring[slot], sym.esi +1, __ATOMIC_RELEASE);
+	return 0;
+die:
+	return -1;
+}
+
+
+/*	ffec_ingest_drain()
+Decode side, one thread only: decode all symbols queued by ffec_ingest()
+	so far, FFEC_INGEST_BATCH at a time (see ffec_decode_batch()).
+Call it repeatedly (e.g. after waiting on whatever wakes the receive threads)
+	until it returns 0.
+
+Symbols queued out of order (a thread is slower to publish than one which
+	claimed a later slot) are picked up on the next call.
+
+Returns number of source symbols yet to receive/decode, '-1' on error.
+A return of '0' also means that no receive thread is still copying
+	any source symbol into the matrix.
+*/
+uint32_t	ffec_ingest_drain(const struct ffec_params	*fp,
+				struct ffec_instance		*fi)
+{
+	int err_cnt = 0;
+	NB_die_if(!fp || !fi || !fi->ingest, "args");
+	NB_die_if(fi->flags & FFEC_DEC_DEFERRED, "not with FFEC_DEC_DEFERRED");
+	struct ffec_ingest_ *ing = fi->ingest;
+
+	struct ffec_symbol syms[FFEC_INGEST_BATCH];
+	uint32_t cnt;
+	do {
+		for (cnt = 0; cnt < FFEC_INGEST_BATCH && ing->head < fi->cnt.n; cnt++) {
+			uint32_t esi = __atomic_load_n(&ing->ring[ing->head], __ATOMIC_ACQUIRE);
+			if (!esi)
+				break;
+			ing->head++;
+			esi--;
+			ing->drained[esi / 64] |= 1ULL << (esi % 64);
+			/* slot left to a receive thread by the decoder: now it's there */
+			if ((ing->waiting[esi / 64] >> (esi % 64)) & 0x1) {
+				ing->waiting[esi / 64] &= ~(1ULL << (esi % 64));
+				ing->waiting_cnt--;
+				if (fi->sink)
+					NB_err_if(ffec_sink_done_(fp, fi, esi),
+						"esi %"PRIu32": sink", esi);
+			}
+			/* in place: see ffec_decode_sym() */
+			syms[cnt] = (struct ffec_symbol){ .sym = NULL, .esi = esi };
+		}
+		if (cnt)
+			NB_die_if(ffec_decode_batch(fp, fi, syms, cnt) == (uint32_t)-1, "");
+	} while (cnt == FFEC_INGEST_BATCH);
+	if (err_cnt)
+		goto die;
+
+	return fi->cnt.k - fi->cnt.k_decoded + ing->waiting_cnt;
+die:
+	return -1;
+}
+
+
+/*	ffec_ingest_free_()
+Free ingest state; called by ffec_free().
+*/
+void		ffec_ingest_free_(struct ffec_instance		*fi)
+{
+	if (!fi->ingest)
+		return;
+	free(fi->ingest->claimed);
+	free(fi->ingest->drained);
+	free(fi->ingest->waiting);
+	free(fi->ingest->ring);
+	free(fi->ingest);
+	fi->ingest = NULL;
+}
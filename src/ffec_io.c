@@ -0,0 +1,445 @@
+/*	ffec_io.c
+
+Zero-copy transmit and receive: see ffec_io.h
+*/
+
+#include <ffec_io.h>
+#include <ffec_internal.h>
+
+
+/*	ffec_enc_iov()
+Fill I/O vectors for symbols 'i' to 'i + cnt' (exclusive) of the sequence
+	given by ffec_enc_seq(), so that they can be sent with
+	writev()/sendmsg() without copying any symbol.
+
+'hdr' MUST hold 'cnt' headers, and 'iov' 'cnt * FFEC_IO_IOV' vectors:
+	symbol 'j' is 'iov[j * FFEC_IO_IOV]' (its header, in 'hdr[j]'),
+	followed by 'iov[j * FFEC_IO_IOV +1]' (the symbol,
+	in the source region or the parity region).
+Both MUST stay valid until the symbols are sent.
+
+Parity symbols MUST be final (see ffec_encode()).
+
+Returns the number of symbols filled: less than 'cnt' at the end
+	of the sequence, 0 once past it.
+*/
+uint32_t	ffec_enc_iov	(const struct ffec_params	*fp,
+				const struct ffec_instance	*fi,
+				uint32_t			i,
+				uint32_t			cnt,
+				uint32_t			*hdr,
+				struct iovec			*iov)
+{
+	if (i >= fi->cnt.n)
+		return 0;
+	if (cnt > fi->cnt.n - i)
+		cnt = fi->cnt.n - i;
+
+	for (uint32_t j=0; j < cnt; j++, iov += FFEC_IO_IOV) {
+		struct ffec_symbol sym = ffec_enc_seq(fp, fi, i + j);
+		hdr[j] = htonl(sym.esi);
+		iov[0].iov_base = &hdr[j];
+		iov[0].iov_len = FFEC_IO_HDR_LEN;
+		/* iovec is not const-correct */
+		iov[1].iov_base = (void *)sym.sym;
+		iov[1].iov_len = fp->sym_len;
+	}
+	return cnt;
+}
+
+
+#ifdef __linux__
+/*	ffec_enc_mmsg()
+As ffec_enc_iov(), and point 'msgs' (which MUST hold 'cnt' messages)
+	at the vectors: one datagram per symbol, ready for sendmmsg().
+Only 'msg_iov' and 'msg_iovlen' are set: the caller sets the rest
+	(e.g. 'msg_name' on an unconnected socket) once.
+*/
+uint32_t	ffec_enc_mmsg	(const struct ffec_params	*fp,
+				const struct ffec_instance	*fi,
+				uint32_t			i,
+				uint32_t			cnt,
+				uint32_t			*hdr,
+				struct iovec			*iov,
+				struct mmsghdr			*msgs)
+{
+	cnt = ffec_enc_iov(fp, fi, i, cnt, hdr, iov);
+	for (uint32_t j=0; j < cnt; j++) {
+		msgs[j].msg_hdr.msg_iov = &iov[j * FFEC_IO_IOV];
+		msgs[j].msg_hdr.msg_iovlen = FFEC_IO_IOV;
+	}
+	return cnt;
+}
+#endif
+
+
+/*
+	Zero-copy receive.
+
+The caller receives straight into blocks of the decoder's own 'dec_source'
+	region (ffec_rx_slot()), before knowing which ESI each will hold.
+Blocks are lent in the order the encoder sends symbols (ffec_enc_seq()),
+	which the decoder knows from the seeds: on a clean link,
+	every symbol lands in its own block and nothing is ever copied.
+A symbol landing in another one's block just swaps the two blocks over
+	(see 'map' in struct ffec_rx_); once everything is decoded,
+	only source symbols still out of place are moved (ffec_rx_finish_()).
+*/
+
+
+/*	ffec_rx_lent_()
+*/
+NLC_INLINE int		ffec_rx_lent_	(const struct ffec_rx_		*rx,
+					uint32_t			block)
+{
+	return (rx->lent[block / 64] >> (block % 64)) & 0x1;
+}
+
+/*	ffec_rx_swap_()
+Swap the blocks of ESIs 'a' and 'b'.
+*/
+NLC_INLINE void		ffec_rx_swap_	(struct ffec_rx_		*rx,
+					uint32_t			a,
+					uint32_t			b)
+{
+	uint32_t block = rx->map[a];
+	rx->map[a] = rx->map[b];
+	rx->map[b] = block;
+	rx->inv[rx->map[a]] = a;
+	rx->inv[rx->map[b]] = b;
+}
+
+/*	ffec_rx_free_esi_()
+Returns 1 if the block of 'esi' may be lent (or taken over):
+	it holds nothing the decoder needs, and is not lent already.
+A parity symbol the decoder is done with is only needed again
+	with FFEC_DEC_DEFERRED (at the very end).
+*/
+NLC_INLINE int		ffec_rx_free_esi_(const struct ffec_instance	*fi,
+					uint32_t			esi)
+{
+	if (ffec_rx_lent_(fi->rx, fi->rx->map[esi]))
+		return 0;
+	if (esi >= fi->cnt.k && !(fi->flags & FFEC_DEC_DEFERRED))
+		return 1;
+	return !ffec_dec_known_(fi, esi);
+}
+
+/*	ffec_rx_spare_()
+Next ESI, after the last one tried, whose block is free; -1 if none.
+*/
+static uint32_t	ffec_rx_spare_		(const struct ffec_instance	*fi,
+					uint32_t			not)
+{
+	struct ffec_rx_ *rx = fi->rx;
+	for (uint32_t i=0; i < fi->cnt.n; i++) {
+		uint32_t esi = rx->spare;
+		if (++rx->spare == fi->cnt.n)
+			rx->spare = 0;
+		if (esi != not && ffec_rx_free_esi_(fi, esi))
+			return esi;
+	}
+	return -1;
+}
+
+
+/*	ffec_rx_init()
+Set up a DECODE instance to receive into its own memory (ffec_rx_slot()).
+Not with ffec_ingest().
+Set 'fi->flags' first: parity blocks can only be received into
+	if the psums are moved out of them (which FFEC_DEC_DEFERRED doesn't use),
+	at the cost of as much memory again.
+returns 0 on success
+*/
+int		ffec_rx_init	(const struct ffec_params	*fp,
+				struct ffec_instance		*fi)
+{
+	int err_cnt = 0;
+	NB_die_if(!fp || !fi, "args");
+	NB_die_if(!fi->dec_source, "not a decode instance");
+	NB_die_if(fi->rx, "already set up");
+	NB_die_if(fi->ingest, "not with ffec_ingest()");
+	if (!(fi->flags & FFEC_DEC_DEFERRED))
+		NB_die_if(ffec_psums_own_(fp, fi), "");
+
+	struct ffec_rx_ *rx;
+	NB_die_if(!(
+		rx = fi->rx = calloc(1, sizeof(*fi->rx))
+		), "");
+	NB_die_if(!(
+		rx->map = malloc(sizeof(uint32_t) * fi->cnt.n)
+		), "");
+	NB_die_if(!(
+		rx->inv = malloc(sizeof(uint32_t) * fi->cnt.n)
+		), "");
+	NB_die_if(!(
+		rx->seq = malloc(sizeof(uint32_t) * fi->cnt.n)
+		), "");
+	NB_die_if(!(
+		rx->pos = malloc(sizeof(uint32_t) * fi->cnt.n)
+		), "");
+	NB_die_if(!(
+		rx->lent = calloc((fi->cnt.n + 63) / 64, sizeof(uint64_t))
+		), "");
+	NB_die_if(!(
+		rx->tmp = malloc(fp->sym_len)
+		), "");
+
+	for (uint32_t i=0; i < fi->cnt.n; i++)
+		rx->map[i] = rx->inv[i] = i;
+	ffec_esi_rand_(fi, rx->seq);
+	for (uint32_t i=0; i < fi->cnt.n; i++)
+		rx->pos[rx->seq[i]] = i;
+
+	return 0;
+die:
+	ffec_rx_free_(fi);
+	return err_cnt;
+}
+
+
+/*	ffec_rx_finish_()
+Move every source symbol which is not in its own block there:
+	swapped with another source symbol in the way, over a parity one.
+A source symbol in place is never moved again (it's no-one else's block),
+	so one pass does it.
+*/
+static void	ffec_rx_finish_		(const struct ffec_params	*fp,
+					struct ffec_instance		*fi)
+{
+	struct ffec_rx_ *rx = fi->rx;
+	uint32_t moved = 0;
+	for (uint32_t esi=0; esi < fi->cnt.k; esi++) {
+		uint32_t block = rx->map[esi];
+		if (block == esi)
+			continue;
+		void *from = fi->dec_source + ((size_t)fp->sym_len * block);
+		void *to = fi->dec_source + ((size_t)fp->sym_len * esi);
+		/* source symbol in the way: swap */
+		if (rx->inv[esi] < fi->cnt.k) {
+			memcpy(rx->tmp, to, fp->sym_len);
+			memcpy(to, from, fp->sym_len);
+			memcpy(from, rx->tmp, fp->sym_len);
+		} else {
+			memcpy(to, from, fp->sym_len);
+		}
+		ffec_rx_swap_(rx, esi, rx->inv[esi]);
+		moved++;
+	}
+	rx->done = 1;
+	NB_wrn("%"PRIu32" source symbols moved into place", moved);
+}
+
+
+/*	ffec_rx_left_()
+*/
+static uint32_t	ffec_rx_left_		(const struct ffec_params	*fp,
+					struct ffec_instance		*fi)
+{
+	uint32_t left = fi->cnt.k - fi->cnt.k_decoded;
+	if (left)
+		return left;
+	if (fi->rx->lent_cnt)
+		return fi->rx->lent_cnt;
+	if (!fi->rx->done) {
+		/* FFEC_DEC_DEFERRED: held back until no slot is lent */
+		if (ffec_dec_sched_finish_(fp, fi))
+			return -1;
+		ffec_rx_finish_(fp, fi);
+	}
+	return 0;
+}
+
+
+/*	ffec_rx_slot()
+Lend a block of 'sym_len' Bytes to receive one symbol into:
+	that of the next symbol expected, if possible.
+The caller MUST give it back, received into (ffec_rx_commit())
+	or not (ffec_rx_release()).
+Sets 'slot'; returns NULL if no block is free or decoding is done.
+*/
+void		*ffec_rx_slot	(const struct ffec_params	*fp,
+				struct ffec_instance		*fi,
+				uint32_t			*slot)
+{
+	struct ffec_rx_ *rx = fi->rx;
+	if (!rx || fi->cnt.k_decoded == fi->cnt.k)
+		return NULL;
+
+	uint32_t esi = -1;
+	while (rx->next < fi->cnt.n) {
+		if (ffec_rx_free_esi_(fi, rx->seq[rx->next++])) {
+			esi = rx->seq[rx->next -1];
+			break;
+		}
+	}
+	/* past the end of the sequence (e.g. retransmissions): any block */
+	if (esi == (uint32_t)-1 && (esi = ffec_rx_spare_(fi, -1)) == (uint32_t)-1)
+		return NULL;
+
+	*slot = rx->map[esi];
+	rx->lent[*slot / 64] |= 1ULL << (*slot % 64);
+	rx->lent_cnt++;
+	return fi->dec_source + ((size_t)fp->sym_len * *slot);
+}
+
+
+/*	ffec_rx_release()
+Give back a slot which nothing was received into.
+Returns as ffec_rx_commit().
+*/
+uint32_t	ffec_rx_release	(const struct ffec_params	*fp,
+				struct ffec_instance		*fi,
+				uint32_t			slot)
+{
+	int err_cnt = 0;
+	NB_die_if(!fp || !fi || !fi->rx, "args");
+	NB_die_if(slot >= fi->cnt.n || !ffec_rx_lent_(fi->rx, slot), "slot %"PRIu32, slot);
+	fi->rx->lent[slot / 64] &= ~(1ULL << (slot % 64));
+	fi->rx->lent_cnt--;
+	return ffec_rx_left_(fp, fi);
+die:
+	return -1;
+}
+
+
+/*	ffec_rx_commit()
+Decode the symbol received into 'slot' as 'esi':
+	in place if it's the block of 'esi', else after swapping the two blocks.
+Either way, no copy.
+A symbol which is not needed (duplicate, already decoded) is dropped.
+
+Returns the number of source symbols yet to receive/decode or,
+	once all are decoded, the number of slots still lent:
+	0 means every source symbol is in place in 'dec_source'.
+Returns '-1' on error (e.g. invalid ESI, CRC): the slot is given back anyway.
+*/
+uint32_t	ffec_rx_commit	(const struct ffec_params	*fp,
+				struct ffec_instance		*fi,
+				uint32_t			slot,
+				uint32_t			esi)
+{
+	int err_cnt = 0;
+	NB_die_if(ffec_rx_release(fp, fi, slot) == (uint32_t)-1, "");
+	struct ffec_rx_ *rx = fi->rx;
+	NB_die_if(esi >= fi->cnt.n, "esi %"PRIu32" >= n %"PRIu32, esi, fi->cnt.n);
+	if (fi->cnt.k_decoded == fi->cnt.k || ffec_dec_known_(fi, esi))
+		return ffec_rx_left_(fp, fi);
+
+	if (rx->inv[slot] != esi)
+		ffec_rx_swap_(rx, esi, rx->inv[slot]);
+	/* resync with the sender, e.g. after a loss */
+	if (rx->pos[esi] >= rx->next)
+		rx->next = rx->pos[esi] +1;
+
+	struct ffec_symbol sym = {
+		.sym = fi->dec_source + ((size_t)fp->sym_len * slot),
+		.esi = esi
+	};
+	NB_die_if(ffec_decode_sym(fp, fi, sym) == (uint32_t)-1, "");
+	return ffec_rx_left_(fp, fi);
+die:
+	return -1;
+}
+
+
+/*	ffec_rx_own_()
+Called by the decoder before it writes a recovered 'esi':
+	if the block of 'esi' is lent (the caller may be receiving into it),
+	swap it for a free one.
+returns 0 on success
+*/
+int		ffec_rx_own_	(struct ffec_instance		*fi,
+				uint32_t			esi)
+{
+	if (!fi->rx || !ffec_rx_lent_(fi->rx, fi->rx->map[esi]))
+		return 0;
+	uint32_t spare = ffec_rx_spare_(fi, esi);
+	if (spare == (uint32_t)-1)
+		return 1;
+	ffec_rx_swap_(fi->rx, esi, spare);
+	return 0;
+}
+
+
+/*	ffec_rx_free_()
+Free receive slot state; called by ffec_free().
+*/
+void		ffec_rx_free_	(struct ffec_instance		*fi)
+{
+	if (!fi->rx)
+		return;
+	free(fi->rx->map);
+	free(fi->rx->inv);
+	free(fi->rx->lent);
+	free(fi->rx->seq);
+	free(fi->rx->pos);
+	free(fi->rx->tmp);
+	free(fi->rx);
+	fi->rx = NULL;
+}
+
+
+#ifdef __linux__
+/*	ffec_rx_mmsg()
+Lend up to 'cnt' slots (see ffec_rx_slot()) into 'slots' and point 'msgs'
+	at them, for recvmmsg(): each datagram is received as its
+	ESI header (into 'hdr') followed by the symbol, straight into the slot.
+'iov' MUST hold 'cnt * FFEC_IO_IOV' vectors.
+Returns the number of slots lent: pass it to ffec_rx_mmsg_commit().
+*/
+uint32_t	ffec_rx_mmsg	(const struct ffec_params	*fp,
+				struct ffec_instance		*fi,
+				uint32_t			cnt,
+				uint32_t			*slots,
+				uint32_t			*hdr,
+				struct iovec			*iov,
+				struct mmsghdr			*msgs)
+{
+	uint32_t j = 0;
+	for (; j < cnt; j++, iov += FFEC_IO_IOV) {
+		void *sym = ffec_rx_slot(fp, fi, &slots[j]);
+		if (!sym)
+			break;
+		iov[0].iov_base = &hdr[j];
+		iov[0].iov_len = FFEC_IO_HDR_LEN;
+		iov[1].iov_base = sym;
+		iov[1].iov_len = fp->sym_len;
+		msgs[j].msg_hdr.msg_iov = iov;
+		msgs[j].msg_hdr.msg_iovlen = FFEC_IO_IOV;
+	}
+	return j;
+}
+
+
+/*	ffec_rx_mmsg_commit()
+After recvmmsg() returned 'rcvd' of the 'lent' messages set up by
+	ffec_rx_mmsg(): commit those which hold a symbol, release the rest.
+Returns as ffec_rx_commit(); '-1' if any datagram failed
+	(the others are still decoded).
+*/
+uint32_t	ffec_rx_mmsg_commit(const struct ffec_params	*fp,
+				struct ffec_instance		*fi,
+				uint32_t			lent,
+				uint32_t			rcvd,
+				const uint32_t			*slots,
+				const uint32_t			*hdr,
+				const struct mmsghdr		*msgs)
+{
+	if (!lent)
+		return ffec_rx_left_(fp, fi);
+	uint32_t left = 0;
+	int failed = 0;
+	for (uint32_t j=0; j < lent; j++) {
+		if (j < rcvd && msgs[j].msg_len == FFEC_IO_HDR_LEN + fp->sym_len)
+			left = ffec_rx_commit(fp, fi, slots[j], ntohl(hdr[j]));
+		else
+			left = ffec_rx_release(fp, fi, slots[j]);
+		if (left == (uint32_t)-1)
+			failed = 1;
+	}
+	if (failed)
+		return -1;
+	return left;
+}
+#endif
@@ -8,20 +8,24 @@ Everything apropos symbol shuffling/distribution:
 
 
 #include <ffec_internal.h>
+#include <stddef.h> /* offsetof() */
 
 
 /*	ffec_esi_rand_()
 
 Populate memory at 'esi_seq' with a randomly shuffled array of all the ESIs
-	in 'fi' starting from 'esi_start' (set it to 0 to obtain all symbols).
+	in 'fi'.
 Uses Knuth-Fisher-Yates.
 
 NOTE: 'esi_seq' should have been allocated by the caller and should be
-	of size >= '(fi->cnt.n - esi_start) * sizeof(uint32_t)'
+	of size >= 'fi->cnt.n * sizeof(uint32_t)'
 
 This function is used e.g.: in determining the order in which to send symbols over the wire.
+It depends only on the seeds: the decoder can predict that order
+	(see ffec_rx_init()).
 */
-void		ffec_esi_rand_	(const struct ffec_instance	*fi)
+void		ffec_esi_rand_	(const struct ffec_instance	*fi,
+				uint32_t			*esi_seq)
 {
 	/* derive seeds from existing instance */
 	uint64_t seeds[2] = {
@@ -45,18 +49,92 @@ void		ffec_esi_rand_	(const struct ffec_instance	*fi)
 
 	TODO: Does this compromise the randomness of the shuffle?
 	*/
-	fi->esi_seq[0] = 0;
-	fi->esi_seq[1] = 1;
+	esi_seq[0] = 0;
+	esi_seq[1] = 1;
 	for (uint32_t i=2, rand, temp; i < fi->cnt.n; i++) {
-		fi->esi_seq[i] = i;
+		esi_seq[i] = i;
 		rand = pcg_rand_bound(&rnd, i);
 		/* use temp var (not triple-XOR): avoid XORing a cell with itself */
-		temp = fi->esi_seq[i];
-		fi->esi_seq[i] = fi->esi_seq[rand];
-		fi->esi_seq[rand] = temp;
+		temp = esi_seq[i];
+		esi_seq[i] = esi_seq[rand];
+		esi_seq[rand] = temp;
 	}
 
-	NB_dump(fi->esi_seq, fi->cnt.n, "randomized ESI sequence:");
+	NB_dump(esi_seq, fi->cnt.n, "randomized ESI sequence:");
+}
+
+
+/*	ffec_gen_rows_()
+Assign a row to each of the 'k * FFEC_N1_DEGREE' source cells, whose row ids
+	are 'stride' uint32_t apart from 'row_id' on:
+	a.) in diagonal fashion,
+	b.) then RANDOMLY SWAP them between each other.
+Encode and decode call this with different strides,
+	and MUST obtain the same rows.
+
+With a 'window' (see ffec_params), the diagonal is monotonic
+	(cell 'i' in row 'i * rows / cells', so that consecutive columns
+	are in consecutive rows) and a cell is only swapped with one at most
+	'window' rows' worth of cells before it.
+The matrix is banded, rows keep the same weights,
+	and encode/decode touch parity symbols (psums) in a sliding window
+	instead of all over the block.
+NOTE that a cell swapped down may be swapped down again:
+	the rows of ~80% of columns span less than 2 windows,
+	the rest have a geometric tail.
+*/
+NLC_INLINE void	ffec_gen_rows_	(const struct ffec_params *fp,
+				struct ffec_instance	*fi,
+				uint32_t		*row_id,
+				const size_t		stride)
+{
+	uint32_t cell_cnt = fi->cnt.k * FFEC_N1_DEGREE;
+	uint32_t i, j, temp;
+	/* swap distance, in cells: 'cell_cnt' is unbounded */
+	uint32_t span = cell_cnt;
+
+	if (fp->window) {
+		for (i=0; i < cell_cnt; i++)
+			row_id[i * stride] = (uint64_t)i * fi->cnt.rows / cell_cnt;
+		span = (uint64_t)fp->window * cell_cnt / fi->cnt.rows;
+		if (span < FFEC_N1_DEGREE)
+			span = FFEC_N1_DEGREE;
+		if (span > cell_cnt)
+			span = cell_cnt;
+	} else {
+		for (i=0; i < cell_cnt; i++)
+			row_id[i * stride] = i % fi->cnt.rows;
+	}
+
+	/*
+		source symbol swap
+	
+	Swap row_id among cells in order to randomize XOR distribution.
+	The algorithm used is 'Knuth-Fisher-Yates'.
+
+	Perform all the randomization passes without assigning the cells to a row.
+	NOTE that back-to-front is a faster pcg_rand_bound() than front-to-back.
+	*/
+	for (uint32_t z=0; z < FFEC_RAND_PASSES; z++) {
+		for (i = cell_cnt -1; i > 0; i--) {
+			j = (i > span) ? i - span + pcg_rand_bound(&fi->rng, span)
+				: pcg_rand_bound(&fi->rng, i);
+			/* Use a temp variable instead of triple-XOR so that
+				we don't worry about XORing a cell with itself.
+			 */
+			temp = row_id[j * stride];
+			row_id[j * stride] = row_id[i * stride];
+			row_id[i * stride] = temp;
+		}
+		/* Swap cell 0, which isn't touched by the above loop.
+		NOTE: this swap makes it unsafe for us to have assigned cells to their
+			rows in the above loop.
+		*/
+		j = pcg_rand_bound(&fi->rng, (span < cell_cnt) ? span : cell_cnt-1);
+		temp = row_id[j * stride];
+		row_id[j * stride] = row_id[0];
+		row_id[0] = temp;
+	}
 }
 
 
@@ -71,20 +149,27 @@ Our tactic takes advantage of the fact that "columns" are implicit
 	a.) assign rows to cells in diagonal fashion,
 	b.) RANDOMLY SWAP CELLS between each other,
 	c.) link each cell to its row.
+
+The encoder only ever reads the row of each source cell:
+	it gets just those (see ffec_enc_col()).
 */
-void		ffec_gen_matrix_(struct ffec_instance	*fi)
+void		ffec_gen_matrix_(const struct ffec_params	*fp,
+				struct ffec_instance		*fi)
 {
+	if (fi->enc_source) {
+		ffec_gen_rows_(fp, fi, fi->col_rows, 1);
+		return;
+	}
+
 	/*
 		initialize cells and rows
 	*/
 	unsigned int i, j;
 	struct ffec_cell *cell = fi->cells;
-	/* Initialize cells for 'k' source symbols. */
+	/* Initialize cells for 'k' source symbols (rows assigned below). */
 	uint32_t cell_cnt = fi->cnt.k * FFEC_N1_DEGREE;
-	for (i=0; i < cell_cnt; i++, cell++) {
-		cell->row_id = i % fi->cnt.rows;
+	for (i=0; i < cell_cnt; i++, cell++)
 		ffec_cell_init(cell, i);
-	}
 	/* Initialize cells for 'n-k' repair symbols */
 	cell_cnt += fi->cnt.p * FFEC_N1_DEGREE;
 	for (; i < cell_cnt; i++, cell++)
@@ -126,44 +211,12 @@ void		ffec_gen_matrix_(struct ffec_instance	*fi)
 	}
 
 
-	/*
-		source symbol swap
-	
-	Swap row_id among cells in order to randomize XOR distribution.
-	The algorithm used is 'Knuth-Fisher-Yates'.
-	*/
-	struct ffec_cell *cell_b;
-	uint32_t temp;
-	cell_cnt = fi->cnt.k * FFEC_N1_DEGREE;
-
-	/* Perform all the randomization passes without assigning the cells to a row.
-	NOTE that back-to-front is a faster pcg_rand_bound() than front-to-back.
-	*/
-	for (uint32_t z=0; z < FFEC_RAND_PASSES; z++) {
-		for (i = cell_cnt -1, cell = &fi->cells[cell_cnt -1];
-			i > 0;
-			i--, cell--)
-		{
-			cell_b = &fi->cells[pcg_rand_bound(&fi->rng, i)];
-			/* Use a temp variable instead of triple-XOR so that
-				we don't worry about XORing a cell with itself.
-			 */
-			temp = cell_b->row_id;
-			cell_b->row_id = cell->row_id;
-			cell->row_id = temp;
-		}
-		/* Swap cell 0, which isn't touched by the above loop.
-		NOTE: this swap makes it unsafe for us to have assigned cells to their
-			rows in the above loop.
-		*/
-		cell = fi->cells;
-		cell_b = &fi->cells[pcg_rand_bound(&fi->rng, cell_cnt-1)];
-		temp = cell_b->row_id;
-		cell_b->row_id = cell->row_id;
-		cell->row_id = temp;
-	}
+	/* source cells: rows */
+	ffec_gen_rows_(fp, fi, (uint32_t *)((void *)fi->cells + offsetof(struct ffec_cell, row_id)),
+			sizeof(struct ffec_cell) / sizeof(uint32_t));
 
 	/* assign cells to rows */
+	cell_cnt = fi->cnt.k * FFEC_N1_DEGREE;
 	for (cell = &fi->cells[cell_cnt-1]; cell >= fi->cells; cell--)
 		ffec_matrix_row_link(&fi->rows[cell->row_id], cell, fi->cells);
 }
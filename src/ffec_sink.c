@@ -0,0 +1,174 @@
+/*	ffec_sink.c
+
+Decoded-output sink: hand each source symbol on as soon as it is final
+	(received, or recovered), rather than only once the whole block is.
+
+The decoder tells ffec_sink_done_() about each source symbol exactly once,
+	when its data is in the matrix:
+- ffec_decode_sym(): once received (and its CRC checked),
+	or once recovered.
+- FFEC_DEC_DEFERRED: once received, or once computed by phase 2
+	(recovered symbols are only computed then, once the block is complete).
+- ffec_ingest(): once drained; a symbol recovered while its received copy
+	was still in flight, once that copy is there.
+
+Along with each one goes the "watermark": the number of leading source
+	symbols which are all final.
+A writer can flush everything below it, in order, while the rest of the block
+	is still arriving (see ffec_sink_fd()).
+*/
+
+#include <ffec_internal.h>
+#include <unistd.h> /* write() */
+#include <string.h> /* strerror() */
+#include <errno.h>
+
+
+/*	ffec_sink_init()
+Have 'cb' called (with 'arg') for each source symbol as it is final.
+Must be called before anything is decoded.
+'cb' is called by whichever thread decodes (see ffec_ingest_drain()),
+	from within the decode call: it should be quick, and not decode.
+'sym' is only good until the next decode call (see ffec_rx_init()).
+returns 0 on success
+*/
+int		ffec_sink_init	(const struct ffec_params	*fp,
+				struct ffec_instance		*fi,
+				ffec_sink_f			cb,
+				void				*arg)
+{
+	int err_cnt = 0;
+	struct ffec_sink_ *sk = NULL;
+	NB_die_if(!fp || !fi || !cb, "args");
+	NB_die_if(!fi->dec_source, "not a decode instance");
+	NB_die_if(fi->sink, "already set up");
+	NB_die_if(fi->cnt.k_decoded, "must be set up before decoding");
+
+	NB_die_if(!(
+		sk = calloc(1, sizeof(*sk))
+		), "");
+	NB_die_if(!(
+		sk->done = calloc((fi->cnt.k + 63) / 64, sizeof(uint64_t))
+		), "");
+	sk->cb = cb;
+	sk->arg = arg;
+	sk->fd = -1;
+	fi->sink = sk;
+
+	return 0;
+die:
+	if (sk)
+		free(sk->done);
+	free(sk);
+	return err_cnt;
+}
+
+
+/*	ffec_sink_write_()
+ffec_sink_fd() callback: write out all source symbols below the watermark
+	not yet written, merging adjacent blocks into one write().
+*/
+static int	ffec_sink_write_	(const struct ffec_params	*fp,
+					const struct ffec_instance	*fi,
+					uint32_t			esi,
+					const void			*sym,
+					uint32_t			low,
+					void				*arg)
+{
+	int err_cnt = 0;
+	struct ffec_sink_ *sk = arg;
+	NB_die_if(sk->err, "fd %d: earlier write failed", sk->fd);
+
+	while (sk->written < low) {
+		/* blocks are in order, unless receive slots swapped them */
+		const void *from = ffec_dec_sym(fp, fi, sk->written);
+		uint32_t cnt = 1;
+		while (sk->written + cnt < low
+			&& ffec_dec_sym(fp, fi, sk->written + cnt)
+				== from + ((size_t)fp->sym_len * cnt))
+		{
+			cnt++;
+		}
+
+		size_t len = (size_t)fp->sym_len * cnt;
+		while (len) {
+			ssize_t ret = write(sk->fd, from, len);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			sk->err = (ret <= 0);
+			NB_die_if(sk->err, "fd %d: write %zu: %s", sk->fd, len,
+				ret ? strerror(errno) : "nothing written");
+			from += ret;
+			len -= ret;
+		}
+		sk->written += cnt;
+	}
+
+die:
+	return err_cnt;
+}
+
+
+/*	ffec_sink_fd()
+Write the decoded source region to 'fd', in order, as it becomes final:
+	everything below the watermark is written as soon as the watermark
+	moves up (see ffec_sink_init()).
+Writes are plain write()s from within the decode calls: 'fd' may be a file,
+	a pipe or a socket, and a slow one slows decoding down.
+Must be called before anything is decoded.
+returns 0 on success
+*/
+int		ffec_sink_fd	(const struct ffec_params	*fp,
+				struct ffec_instance		*fi,
+				int				fd)
+{
+	int err_cnt = 0;
+	NB_die_if(fd < 0, "fd %d", fd);
+	NB_die_if(ffec_sink_init(fp, fi, ffec_sink_write_, NULL), "");
+	fi->sink->arg = fi->sink;
+	fi->sink->fd = fd;
+die:
+	return err_cnt;
+}
+
+
+/*	ffec_sink_low()
+Returns the watermark: all source symbols below it are final.
+Once it is 'fi->cnt.k', so is the whole block.
+*/
+uint32_t	ffec_sink_low	(const struct ffec_instance	*fi)
+{
+	if (!fi || !fi->sink)
+		return 0;
+	return fi->sink->low;
+}
+
+
+/*	ffec_sink_done_()
+Called by the decoder once source symbol 'esi' is final (and only once).
+returns 0 on success, otherwise what the callback returned
+*/
+int		ffec_sink_done_	(const struct ffec_params	*fp,
+				struct ffec_instance		*fi,
+				uint32_t			esi)
+{
+	struct ffec_sink_ *sk = fi->sink;
+	sk->done[esi / 64] |= 1ULL << (esi % 64);
+	while (sk->low < fi->cnt.k && ((sk->done[sk->low / 64] >> (sk->low % 64)) & 0x1))
+		sk->low++;
+	return sk->cb(fp, fi, esi, ffec_dec_sym(fp, fi, esi), sk->low, sk->arg);
+}
+
+
+/*	ffec_sink_free_()
+Free sink state; called by ffec_free().
+Does not close the fd of ffec_sink_fd().
+*/
+void		ffec_sink_free_	(struct ffec_instance		*fi)
+{
+	if (!fi->sink)
+		return;
+	free(fi->sink->done);
+	free(fi->sink);
+	fi->sink = NULL;
+}
@@ -0,0 +1,800 @@
+/*	ffec_solve.c
+
+Inactivation decoding (see FFEC_DEC_SOLVE).
+
+Peeling (ffec_decode_sym()) stalls as soon as every row holds 2 or more
+	missing symbols, even once there are as many rows as missing symbols:
+	the last few percent of a block are then waited for,
+	although they could be solved for.
+When that happens, ffec_solve_() takes on the residual system:
+	missing symbols are its columns, rows still holding any its equations.
+
+1. Peel it symbolically; whenever that stalls, "inactivate" a column:
+	take it as known (a variable of a small dense system) and go on.
+	Each row which peels a column then reads
+		"column = psum + some inactive columns",
+	each row left over holds only inactive columns.
+2. Gaussian elimination (GF(2), bit-packed) on the rows left over:
+	pick as many independent ones as there are inactive columns
+	(at most FFEC_SOLVE_INACT, which bounds the CPU cost)
+	and invert the square system they make up.
+	Short of full rank, that many more symbols must be received:
+	don't try again before they have been.
+3. Only now touch symbol data: apply to the psums the row operations
+	of step 1 which lead to the picked rows.
+	Each inactive column is the XOR of some of those psums
+	(its row of the inverse): XOR them 8 rows at a time, through
+	a table of their 256 combinations ("Method of Four Russians").
+	Then undo the row operations (XOR is its own inverse).
+4. Decode the inactive columns as if received:
+	peeling now finishes, at the usual cost.
+*/
+
+#include <ffec_internal.h>
+
+
+/* Widest dense system ffec_solve_() takes on.
+Solving it costs about INACT/8 * (INACT + 256) symbol XORs.
+*/
+#ifndef FFEC_SOLVE_INACT
+	#define FFEC_SOLVE_INACT 1024
+#endif
+#define FFEC_SOLVE_WORDS (FFEC_SOLVE_INACT / 64)
+
+/* max number of symbols XORed into by one call to the scatter kernel */
+#define FFEC_SOLVE_SCATTER_CNT 16
+/* ffec_solve_apply_(): rows combined by each table */
+#define FFEC_SOLVE_TAB_BITS 8
+
+/* state of each column */
+enum {
+	FFEC_SOLVE_ACTIVE = 0,
+	FFEC_SOLVE_PEELED,
+	FFEC_SOLVE_INACTIVE
+};
+
+
+/*	ffec_solve_op_
+Row operation: psum of 'dst' ^= psum of 'src' (rows of the residual system).
+*/
+struct ffec_solve_op_ {
+	uint32_t	dst;
+	uint32_t	src;
+};
+
+/*	ffec_solve_sys_
+The residual system, for one try.
+*/
+struct ffec_solve_sys_ {
+	uint32_t		cols;
+	uint32_t		rows;
+	uint32_t		*esi;		/* column -> ESI */
+	uint32_t		*row;		/* row -> matrix row */
+
+	uint32_t		*c_row;		/* rows of each column: FFEC_N1_DEGREE apart */
+	uint8_t			*c_deg;
+	uint8_t			*c_state;
+
+	uint32_t		*r_first;	/* columns of each row (CSR) */
+	uint32_t		*r_col;
+	uint32_t		*r_cnt;		/* active columns left in each row */
+	uint8_t			*r_used;	/* row has peeled a column */
+	uint64_t		*bits;		/* inactive columns in each row:
+							FFEC_SOLVE_WORDS per row
+						*/
+
+	/* rows with 1 (and 2) active columns left; checked when popped */
+	uint32_t		*stk;
+	uint32_t		*stk2;
+	uint32_t		top;
+	uint32_t		top2;
+
+	uint32_t		inact_cnt;
+	uint32_t		*inact;		/* column of each inactive one */
+	uint32_t		*pick;		/* independent rows left over: as many */
+	uint64_t		*inv;		/* inverse of the system of 'pick' rows:
+							FFEC_SOLVE_WORDS per row
+						*/
+
+	struct ffec_solve_op_	*ops;
+	uint32_t		op_cnt;
+	uint32_t		op_max;
+};
+
+
+/*	ffec_solve_new_()
+*/
+static int	ffec_solve_new_		(struct ffec_instance		*fi)
+{
+	int err_cnt = 0;
+	struct ffec_solve_ *sv;
+	NB_die_if(!(
+		sv = fi->solve = calloc(1, sizeof(*fi->solve))
+		), "");
+	NB_die_if(!(
+		sv->col_of = malloc(sizeof(uint32_t) * fi->cnt.n)
+		), "");
+	NB_die_if(!(
+		sv->row_of = malloc(sizeof(uint32_t) * fi->cnt.p)
+		), "");
+
+	for (uint32_t esi=0; esi < fi->cnt.n; esi++) {
+		if (!ffec_test_esi(fi, esi))
+			sv->unknown++;
+	}
+	for (uint32_t r=0; r < fi->cnt.p; r++) {
+		if (!fi->rows[r].cnt)
+			sv->empty++;
+	}
+	sv->next = fi->cnt.n;
+
+	return 0;
+die:
+	ffec_solve_free_(fi);
+	return err_cnt;
+}
+
+
+/*	ffec_solve_free_()
+Free inactivation state; called by ffec_free().
+*/
+void		ffec_solve_free_	(struct ffec_instance		*fi)
+{
+	if (!fi->solve)
+		return;
+	free(fi->solve->col_of);
+	free(fi->solve->row_of);
+	free(fi->solve);
+	fi->solve = NULL;
+}
+
+
+/*	ffec_solve_sys_free_()
+*/
+static void	ffec_solve_sys_free_	(struct ffec_solve_sys_		*sys)
+{
+	free(sys->esi);
+	free(sys->row);
+	free(sys->c_row);
+	free(sys->c_deg);
+	free(sys->c_state);
+	free(sys->r_first);
+	free(sys->r_col);
+	free(sys->r_cnt);
+	free(sys->r_used);
+	free(sys->bits);
+	free(sys->stk);
+	free(sys->stk2);
+	free(sys->inact);
+	free(sys->pick);
+	free(sys->inv);
+	free(sys->ops);
+}
+
+
+/*	ffec_solve_col_()
+Get the rows which column 'esi' is still linked into.
+An ESI twice in the same row cancels out there.
+Returns number of rows written to 'rows'.
+*/
+static unsigned int ffec_solve_col_	(const struct ffec_instance	*fi,
+					uint32_t			esi,
+					uint32_t			*rows)
+{
+	struct ffec_cell *cell = ffec_get_col_first(fi->cells, esi);
+	unsigned int cnt = 0;
+	for (unsigned int j=0; j < FFEC_N1_DEGREE; j++) {
+		if (ffec_cell_test(&cell[j]))
+			continue;
+		unsigned int i = 0;
+		while (i < cnt && rows[i] != cell[j].row_id)
+			i++;
+		if (i < cnt)
+			rows[i] = rows[--cnt];
+		else
+			rows[cnt++] = cell[j].row_id;
+	}
+	return cnt;
+}
+
+
+/*	ffec_solve_build_()
+Extract the residual system from the matrix.
+*/
+static int	ffec_solve_build_	(struct ffec_instance		*fi,
+					struct ffec_solve_sys_		*sys)
+{
+	int err_cnt = 0;
+	struct ffec_solve_ *sv = fi->solve;
+	uint32_t rows[FFEC_N1_DEGREE];
+
+	/* count */
+	for (uint32_t r=0; r < fi->cnt.p; r++) {
+		if (fi->rows[r].cnt)
+			sv->row_of[r] = sys->rows++;
+	}
+	for (uint32_t esi=0; esi < fi->cnt.n; esi++) {
+		if (!ffec_test_esi(fi, esi))
+			sv->col_of[esi] = sys->cols++;
+	}
+	/* resync */
+	sv->unknown = sys->cols;
+	sv->empty = fi->cnt.p - sys->rows;
+
+	NB_die_if(!(
+		sys->esi = malloc(sizeof(uint32_t) * sys->cols)
+		), "");
+	NB_die_if(!(
+		sys->row = malloc(sizeof(uint32_t) * sys->rows)
+		), "");
+	NB_die_if(!(
+		sys->c_row = malloc(sizeof(uint32_t) * sys->cols * FFEC_N1_DEGREE)
+		), "");
+	NB_die_if(!(
+		sys->c_deg = malloc(sys->cols)
+		), "");
+	NB_die_if(!(
+		sys->c_state = calloc(sys->cols, 1)
+		), "");
+	NB_die_if(!(
+		sys->r_first = calloc(sys->rows +1, sizeof(uint32_t))
+		), "");
+	NB_die_if(!(
+		sys->r_cnt = calloc(sys->rows, sizeof(uint32_t))
+		), "");
+	NB_die_if(!(
+		sys->r_used = calloc(sys->rows, 1)
+		), "");
+	NB_die_if(!(
+		sys->bits = calloc((size_t)sys->rows * FFEC_SOLVE_WORDS, sizeof(uint64_t))
+		), "");
+	NB_die_if(!(
+		sys->inact = malloc(sizeof(uint32_t) * FFEC_SOLVE_INACT)
+		), "");
+	NB_die_if(!(
+		sys->pick = malloc(sizeof(uint32_t) * FFEC_SOLVE_INACT)
+		), "");
+
+	for (uint32_t r=0; r < fi->cnt.p; r++) {
+		if (fi->rows[r].cnt)
+			sys->row[sv->row_of[r]] = r;
+	}
+
+	/* columns, and the length of each row */
+	uint32_t nnz = 0;
+	for (uint32_t esi=0; esi < fi->cnt.n; esi++) {
+		if (ffec_test_esi(fi, esi))
+			continue;
+		const uint32_t c = sv->col_of[esi];
+		sys->esi[c] = esi;
+		sys->c_deg[c] = ffec_solve_col_(fi, esi, rows);
+		for (unsigned int j=0; j < sys->c_deg[c]; j++) {
+			const uint32_t v = sv->row_of[rows[j]];
+			sys->c_row[c * FFEC_N1_DEGREE + j] = v;
+			sys->r_first[v +1]++;
+		}
+		nnz += sys->c_deg[c];
+	}
+	for (uint32_t v=0; v < sys->rows; v++)
+		sys->r_first[v +1] += sys->r_first[v];
+
+	/* rows: 'r_cnt' is the fill position until full */
+	NB_die_if(!(
+		sys->r_col = malloc(sizeof(uint32_t) * (nnz +1))
+		), "");
+	for (uint32_t c=0; c < sys->cols; c++) {
+		for (unsigned int j=0; j < sys->c_deg[c]; j++) {
+			const uint32_t v = sys->c_row[c * FFEC_N1_DEGREE + j];
+			sys->r_col[sys->r_first[v] + sys->r_cnt[v]++] = c;
+		}
+	}
+
+	/* every decrement of a row count pushes it at most once */
+	NB_die_if(!(
+		sys->stk = malloc(sizeof(uint32_t) * (nnz + sys->rows))
+		), "");
+	NB_die_if(!(
+		sys->stk2 = malloc(sizeof(uint32_t) * (nnz + sys->rows))
+		), "");
+	sys->op_max = nnz + FFEC_SOLVE_INACT;
+	NB_die_if(!(
+		sys->ops = malloc(sizeof(struct ffec_solve_op_) * sys->op_max)
+		), "");
+
+die:
+	return err_cnt;
+}
+
+
+/*	ffec_solve_push_()
+Queue row 'v' if it's down to 1 or 2 active columns.
+*/
+NLC_INLINE void	ffec_solve_push_	(struct ffec_solve_sys_		*sys,
+					uint32_t			v)
+{
+	if (sys->r_cnt[v] == 1)
+		sys->stk[sys->top++] = v;
+	else if (sys->r_cnt[v] == 2)
+		sys->stk2[sys->top2++] = v;
+}
+
+
+/*	ffec_solve_op_()
+Record a row operation.
+returns 0 on success
+*/
+NLC_INLINE int	ffec_solve_op_		(struct ffec_solve_sys_		*sys,
+					uint32_t			dst,
+					uint32_t			src)
+{
+	if (sys->op_cnt == sys->op_max) {
+		struct ffec_solve_op_ *ops = realloc(sys->ops,
+				sizeof(struct ffec_solve_op_) * sys->op_max * 2);
+		if (!ops)
+			return 1;
+		sys->ops = ops;
+		sys->op_max *= 2;
+	}
+	sys->ops[sys->op_cnt++] = (struct ffec_solve_op_){ .dst = dst, .src = src };
+	return 0;
+}
+
+
+/*	ffec_solve_heavy_()
+The active column of row 'v' in the most rows.
+*/
+static uint32_t	ffec_solve_heavy_	(const struct ffec_solve_sys_	*sys,
+					uint32_t			v)
+{
+	uint32_t best = -1;
+	for (uint32_t i = sys->r_first[v]; i < sys->r_first[v +1]; i++) {
+		const uint32_t c = sys->r_col[i];
+		if (sys->c_state[c] != FFEC_SOLVE_ACTIVE)
+			continue;
+		if (best == (uint32_t)-1 || sys->c_deg[c] > sys->c_deg[best])
+			best = c;
+	}
+	return best;
+}
+
+
+/*	ffec_solve_pick_()
+Peeling is stalled: pick a column to inactivate.
+Inactivating one column of a row with 2 left lets peeling go on;
+	failing that, take a row with as few as possible.
+*/
+static uint32_t	ffec_solve_pick_	(struct ffec_solve_sys_		*sys)
+{
+	while (sys->top2) {
+		const uint32_t v = sys->stk2[--sys->top2];
+		if (!sys->r_used[v] && sys->r_cnt[v] == 2)
+			return ffec_solve_heavy_(sys, v);
+	}
+
+	uint32_t best = -1;
+	for (uint32_t v=0; v < sys->rows; v++) {
+		if (sys->r_used[v] || sys->r_cnt[v] < 2)
+			continue;
+		if (best == (uint32_t)-1 || sys->r_cnt[v] < sys->r_cnt[best])
+			best = v;
+	}
+	if (best != (uint32_t)-1)
+		return ffec_solve_heavy_(sys, best);
+
+	/* every active column is in some row with a count: not reached */
+	for (uint32_t c=0; c < sys->cols; c++) {
+		if (sys->c_state[c] == FFEC_SOLVE_ACTIVE)
+			return c;
+	}
+	return -1;
+}
+
+
+/*	ffec_solve_peel_()
+Step 1: peel the residual system, inactivating columns as needed.
+Returns 0 on success, 1 if more than FFEC_SOLVE_INACT columns
+	would have to be inactivated, -1 on error.
+*/
+static int	ffec_solve_peel_	(struct ffec_solve_sys_		*sys)
+{
+	int err_cnt = 0;
+	uint32_t active = sys->cols;
+	for (uint32_t v=0; v < sys->rows; v++)
+		ffec_solve_push_(sys, v);
+
+	while (active) {
+		/* stalled: inactivate a column */
+		if (!sys->top) {
+			const uint32_t c = ffec_solve_pick_(sys);
+			NB_die_if(c == (uint32_t)-1, "%"PRIu32" active columns in no row", active);
+			if (sys->inact_cnt == FFEC_SOLVE_INACT)
+				return 1;
+			const uint32_t i = sys->inact_cnt++;
+			sys->inact[i] = c;
+			sys->c_state[c] = FFEC_SOLVE_INACTIVE;
+			active--;
+			for (unsigned int j=0; j < sys->c_deg[c]; j++) {
+				const uint32_t w = sys->c_row[c * FFEC_N1_DEGREE + j];
+				sys->r_cnt[w]--;
+				sys->bits[(size_t)w * FFEC_SOLVE_WORDS + i / 64] |= 1ULL << (i % 64);
+				ffec_solve_push_(sys, w);
+			}
+			continue;
+		}
+
+		const uint32_t v = sys->stk[--sys->top];
+		if (sys->r_used[v] || sys->r_cnt[v] != 1)
+			continue;
+		uint32_t c = 0;
+		for (uint32_t i = sys->r_first[v]; i < sys->r_first[v +1]; i++) {
+			c = sys->r_col[i];
+			if (sys->c_state[c] == FFEC_SOLVE_ACTIVE)
+				break;
+		}
+		sys->c_state[c] = FFEC_SOLVE_PEELED;
+		sys->r_used[v] = 1;
+		active--;
+
+		/* substitute into its other rows */
+		const uint32_t words = (sys->inact_cnt + 63) / 64;
+		const uint64_t *from = &sys->bits[(size_t)v * FFEC_SOLVE_WORDS];
+		for (unsigned int j=0; j < sys->c_deg[c]; j++) {
+			const uint32_t w = sys->c_row[c * FFEC_N1_DEGREE + j];
+			if (w == v)
+				continue;
+			sys->r_cnt[w]--;
+			uint64_t *to = &sys->bits[(size_t)w * FFEC_SOLVE_WORDS];
+			for (uint32_t k=0; k < words; k++)
+				to[k] ^= from[k];
+			NB_die_if(ffec_solve_op_(sys, w, v), "");
+			ffec_solve_push_(sys, w);
+		}
+	}
+
+	return 0;
+die:
+	return -1;
+}
+
+
+/*	ffec_solve_eliminate_()
+Step 2, on the rows which peeled nothing (they hold only inactive columns):
+- forward elimination on a copy of them: the rows it pivots on
+	are independent ('pick').
+- Gauss-Jordan on [A | I], A the system of the picked rows:
+	row 'i' of the right half says which picked rows XOR
+	to inactive column 'i' ('inv').
+Returns the number of inactive columns which could not be solved for
+	(0 means all of them), -1 on error.
+*/
+static uint32_t	ffec_solve_eliminate_	(struct ffec_solve_sys_		*sys)
+{
+	int err_cnt = 0;
+	const uint32_t r = sys->inact_cnt;
+	const uint32_t words = (r + 63) / 64;
+	uint64_t *a = NULL;
+
+	/* reuse the (empty) stack */
+	uint32_t *d = sys->stk;
+	uint32_t cnt = 0;
+	for (uint32_t v=0; v < sys->rows; v++) {
+		if (!sys->r_used[v])
+			d[cnt++] = v;
+	}
+	if (cnt < r)
+		return r - cnt;
+	if (!r)
+		return 0;
+
+	/* rows as they are eliminated: 'words' each (compact) */
+	NB_die_if(!(
+		a = malloc(sizeof(uint64_t) * ((size_t)cnt * words + (size_t)r * words * 2))
+		), "");
+	for (uint32_t j=0; j < cnt; j++)
+		memcpy(&a[(size_t)j * words], &sys->bits[(size_t)d[j] * FFEC_SOLVE_WORDS],
+			sizeof(uint64_t) * words);
+
+	uint32_t rank = 0;
+	for (uint32_t i=0; i < r; i++) {
+		const uint32_t word = i / 64;
+		const uint64_t bit = 1ULL << (i % 64);
+		uint32_t j = rank;
+		while (j < cnt && !(a[(size_t)j * words + word] & bit))
+			j++;
+		if (j == cnt)
+			continue;
+
+		/* swap into place */
+		uint32_t t = d[j];
+		d[j] = d[rank];
+		d[rank] = t;
+		for (uint32_t k=0; k < words; k++) {
+			uint64_t w = a[(size_t)j * words + k];
+			a[(size_t)j * words + k] = a[(size_t)rank * words + k];
+			a[(size_t)rank * words + k] = w;
+		}
+
+		const uint64_t *from = &a[(size_t)rank * words];
+		for (j = rank +1; j < cnt; j++) {
+			uint64_t *to = &a[(size_t)j * words];
+			if (!(to[word] & bit))
+				continue;
+			for (uint32_t k = word; k < words; k++)
+				to[k] ^= from[k];
+		}
+		sys->pick[rank] = d[rank];
+		rank++;
+	}
+	if (rank < r)
+		goto short_;
+
+	/* [A | I]: 2 * 'words' per row */
+	uint64_t *m = &a[(size_t)cnt * words];
+	const uint32_t w2 = words * 2;
+	memset(m, 0x0, sizeof(uint64_t) * r * w2);
+	for (uint32_t j=0; j < r; j++) {
+		memcpy(&m[(size_t)j * w2], &sys->bits[(size_t)sys->pick[j] * FFEC_SOLVE_WORDS],
+			sizeof(uint64_t) * words);
+		m[(size_t)j * w2 + words + j / 64] |= 1ULL << (j % 64);
+	}
+	for (uint32_t i=0; i < r; i++) {
+		const uint32_t word = i / 64;
+		const uint64_t bit = 1ULL << (i % 64);
+		uint32_t j = i;
+		while (!(m[(size_t)j * w2 + word] & bit))
+			j++;
+		for (uint32_t k=0; k < w2; k++) {
+			uint64_t w = m[(size_t)j * w2 + k];
+			m[(size_t)j * w2 + k] = m[(size_t)i * w2 + k];
+			m[(size_t)i * w2 + k] = w;
+		}
+		const uint64_t *from = &m[(size_t)i * w2];
+		for (j=0; j < r; j++) {
+			uint64_t *to = &m[(size_t)j * w2];
+			if (j == i || !(to[word] & bit))
+				continue;
+			for (uint32_t k=0; k < w2; k++)
+				to[k] ^= from[k];
+		}
+	}
+
+	NB_die_if(!(
+		sys->inv = malloc(sizeof(uint64_t) * r * FFEC_SOLVE_WORDS)
+		), "");
+	for (uint32_t i=0; i < r; i++)
+		memcpy(&sys->inv[(size_t)i * FFEC_SOLVE_WORDS], &m[(size_t)i * w2 + words],
+			sizeof(uint64_t) * words);
+
+short_:
+	free(a);
+	return r - rank;
+die:
+	free(a);
+	return -1;
+}
+
+
+/*	ffec_solve_xor_()
+Apply the row operations still wanted ('dst' not -1) to the psums,
+	forwards or (to undo them) backwards.
+Operations in a run from the same row are independent of each other:
+	they are done by one call to the scatter kernel.
+Returns number of symbol XORs.
+*/
+static uint32_t	ffec_solve_xor_		(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					const struct ffec_solve_sys_	*sys,
+					int				backwards)
+{
+	void *to[FFEC_SOLVE_SCATTER_CNT];
+	uint32_t xors = 0;
+	uint32_t o = 0;
+	while (o < sys->op_cnt) {
+		const struct ffec_solve_op_ *op = &sys->ops[backwards ? sys->op_cnt - o -1 : o];
+		if (op->dst == (uint32_t)-1) {
+			o++;
+			continue;
+		}
+		const uint32_t src = op->src;
+		uint32_t cnt = 0;
+		for (; o < sys->op_cnt && cnt < FFEC_SOLVE_SCATTER_CNT; o++) {
+			op = &sys->ops[backwards ? sys->op_cnt - o -1 : o];
+			if (op->dst == (uint32_t)-1)
+				continue;
+			if (op->src != src)
+				break;
+			to[cnt++] = ffec_get_psum(fp, fi, sys->row[op->dst]);
+		}
+		fi->xops->scatter(ffec_get_psum(fp, fi, sys->row[src]), to, cnt, fp->sym_len);
+		xors += cnt;
+	}
+	return xors;
+}
+
+
+/*	ffec_solve_tab_()
+Combination 'm' of the (up to) FFEC_SOLVE_TAB_BITS symbols at 'src':
+	a single one is used in place, others are computed into 'tab'
+	the first time they are asked for.
+*/
+static const void *ffec_solve_tab_	(const struct ffec_params	*fp,
+					const struct ffec_instance	*fi,
+					const void *const		*src,
+					void				*tab,
+					uint64_t			*built,
+					unsigned int			m)
+{
+	const unsigned int low = m & -m;
+	const void *one = src[__builtin_ctz(m)];
+	if (m == low)
+		return one;
+	void *to = tab + ((size_t)fp->sym_len * m);
+	if (!((built[m / 64] >> (m % 64)) & 0x1)) {
+		const void *from[2] = {
+			ffec_solve_tab_(fp, fi, src, tab, built, m ^ low),
+			one
+		};
+		fi->xops->gather(from, 2, to, fp->sym_len);
+		built[m / 64] |= 1ULL << (m % 64);
+	}
+	return to;
+}
+
+
+/*	ffec_solve_apply_()
+Steps 3 and 4: compute the inactive columns, decode them.
+returns 0 on success
+*/
+static int	ffec_solve_apply_	(const struct ffec_params	*fp,
+					struct ffec_instance		*fi,
+					struct ffec_solve_sys_		*sys)
+{
+	int err_cnt = 0;
+	const uint32_t r = sys->inact_cnt;
+	void *tab = NULL, *out;
+	uint32_t *order = NULL;
+
+	/* drop row operations which lead to no picked row ('r_used' is free) */
+	uint8_t *need = sys->r_used;
+	memset(need, 0x0, sys->rows);
+	for (uint32_t i=0; i < r; i++)
+		need[sys->pick[i]] = 1;
+	for (uint32_t o = sys->op_cnt; o > 0; o--) {
+		struct ffec_solve_op_ *op = &sys->ops[o -1];
+		if (need[op->dst])
+			need[op->src] = 1;
+		else
+			op->dst = -1;
+	}
+	uint32_t xors = ffec_solve_xor_(fp, fi, sys, 0);
+
+	/* tables, then the inactive columns: not in their blocks,
+		which for parity are psums (see ffec_new())
+	*/
+	NB_die_if(posix_memalign(&tab, FFEC_MEM_ALIGN,
+			(size_t)fp->sym_len * ((1 << FFEC_SOLVE_TAB_BITS) + r)), "");
+	out = tab + ((size_t)fp->sym_len << FFEC_SOLVE_TAB_BITS);
+	memset(out, 0x0, (size_t)fp->sym_len * r);
+	NB_die_if(!(
+		order = malloc(sizeof(uint32_t) * (r +1))
+		), "");
+
+	/* 8 picked rows at a time: XOR the combination each column wants */
+	for (uint32_t c=0; c < r; c += FFEC_SOLVE_TAB_BITS) {
+		const void *src[FFEC_SOLVE_TAB_BITS] = { NULL };
+		for (unsigned int b=0; b < FFEC_SOLVE_TAB_BITS && c + b < r; b++)
+			src[b] = ffec_get_psum(fp, fi, sys->row[sys->pick[c + b]]);
+		uint64_t built[(1 << FFEC_SOLVE_TAB_BITS) / 64] = { 0 };
+
+		/* columns, by combination (counting sort) */
+		uint32_t first[(1 << FFEC_SOLVE_TAB_BITS) +1] = { 0 };
+		for (uint32_t i=0; i < r; i++) {
+			const uint64_t *row = &sys->inv[(size_t)i * FFEC_SOLVE_WORDS];
+			first[((row[c / 64] >> (c % 64)) & 0xff) +1]++;
+		}
+		for (unsigned int m=0; m < (1 << FFEC_SOLVE_TAB_BITS); m++)
+			first[m +1] += first[m];
+		for (uint32_t i=0; i < r; i++) {
+			const uint64_t *row = &sys->inv[(size_t)i * FFEC_SOLVE_WORDS];
+			order[first[(row[c / 64] >> (c % 64)) & 0xff]++] = i;
+		}
+
+		/* 'first[m]' is now the end of combination 'm' */
+		void *to[FFEC_SOLVE_SCATTER_CNT];
+		for (unsigned int m=1, i=first[0]; m < (1 << FFEC_SOLVE_TAB_BITS); m++) {
+			if (i == first[m])
+				continue;
+			const void *from = ffec_solve_tab_(fp, fi, src, tab, built, m);
+			while (i < first[m]) {
+				uint32_t cnt = 0;
+				for (; i < first[m] && cnt < FFEC_SOLVE_SCATTER_CNT; i++)
+					to[cnt++] = out + ((size_t)fp->sym_len * order[i]);
+				fi->xops->scatter(from, to, cnt, fp->sym_len);
+				xors += cnt;
+			}
+		}
+	}
+
+	xors += ffec_solve_xor_(fp, fi, sys, 1);
+	NB_wrn("solve: %"PRIu32" missing, %"PRIu32" inactivated, %"PRIu32" XORs",
+		sys->cols, r, xors);
+
+	/* never try again from within */
+	fi->solve->next = 0;
+	for (uint32_t i=0; i < r && fi->cnt.k_decoded < fi->cnt.k; i++) {
+		struct ffec_symbol sym = {
+			.sym = out + ((size_t)fp->sym_len * i),
+			.esi = sys->esi[sys->inact[i]]
+		};
+		/* e.g. a CRC or sink error: the symbol is decoded all the same */
+		NB_err_if(ffec_decode_sym(fp, fi, sym) == (uint32_t)-1,
+			"esi %"PRIu32, sym.esi);
+	}
+	/* not reached, unless the matrix and the residual system disagree */
+	if (fi->cnt.k_decoded < fi->cnt.k) {
+		NB_wrn("solve: %"PRIu32" source symbols still missing",
+			fi->cnt.k - fi->cnt.k_decoded);
+		fi->solve->next = fi->solve->unknown -1;
+	}
+
+die:
+	free(tab);
+	free(order);
+	return err_cnt;
+}
+
+
+/*	ffec_solve_()
+Called by ffec_decode_sym() when peeling stalls:
+	try to finish decoding by inactivation.
+Tries only once there are as many rows left as missing symbols
+	and, after a failed try, once enough more symbols have been received.
+
+Returns 0 unless there is an error: whether decoding is finished
+	shows in 'fi->cnt.k_decoded'.
+*/
+int		ffec_solve_		(const struct ffec_params	*fp,
+					struct ffec_instance		*fi)
+{
+	int err_cnt = 0;
+	struct ffec_solve_sys_ sys = { 0 };
+
+	/* no psums; symbols written by other threads; blocks lent to the caller */
+	if ((fi->flags & FFEC_DEC_DEFERRED) || fi->ingest || (fi->rx && fi->rx->lent_cnt))
+		return 0;
+	if (!fi->solve)
+		NB_die_if(ffec_solve_new_(fi), "");
+	struct ffec_solve_ *sv = fi->solve;
+	if (sv->unknown > sv->next || fi->cnt.p - sv->empty < sv->unknown)
+		return 0;
+
+	NB_die_if(ffec_solve_build_(fi, &sys), "");
+	const uint32_t unknown = sys.cols;
+
+	int ret = ffec_solve_peel_(&sys);
+	NB_die_if(ret < 0, "");
+	if (ret) {
+		NB_wrn("solve: %"PRIu32" missing, more than %d to inactivate",
+			unknown, FFEC_SOLVE_INACT);
+		sv->next = unknown - 1 - unknown / 64;
+		goto die;
+	}
+
+	/* Each symbol received raises the rank by 1 at most:
+		don't try again before as many are received as it falls short.
+	*/
+	uint32_t shortfall = ffec_solve_eliminate_(&sys);
+	NB_die_if(shortfall == (uint32_t)-1, "");
+	if (shortfall) {
+		NB_wrn("solve: %"PRIu32" missing, %"PRIu32" inactivated, rank short by %"PRIu32,
+			unknown, sys.inact_cnt, shortfall);
+		sv->next = unknown - shortfall;
+		goto die;
+	}
+
+	NB_die_if(ffec_solve_apply_(fp, fi, &sys), "");
+
+die:
+	ffec_solve_sys_free_(&sys);
+	return err_cnt;
+}
@@ -7,11 +7,8 @@ Non-essentials go here.
 
 
 /*	ffec_mtx_cmp()
-Compare 2 FEC matrices, cells and rows - which should be identical
-		(because their IDs are offsets, not absolute addresses ;)
-
-NOTE that matrices are NO LONGER identical after decode has started,
-	because decoding will remove cells from the rows.
+Compare an encoder's matrix to a decoder's: the row of every source cell
+	must be identical (the encoder keeps only those, see ffec_enc_col()).
 
 returns 0 if identical
 */
@@ -24,15 +21,14 @@ int ffec_mtx_cmp(struct ffec_instance *enc, struct ffec_instance *dec, struct ff
 		enc->seeds[0], enc->seeds[1], dec->seeds[0], dec->seeds[1]);
 
 	/* verify matrix cells */
-	if (memcmp(enc->cells, dec->cells, sizeof(struct ffec_cell) * enc->cnt.k * FFEC_N1_DEGREE))
-	{
+	uint32_t mismatch_cnt=0;
+	for (uint32_t i=0; i < enc->cnt.k * FFEC_N1_DEGREE; i++) {
+		if (enc->col_rows[i] != dec->cells[i].row_id)
+			mismatch_cnt++;
+	}
+	if (mismatch_cnt) {
 		NB_err("FEC matrices mismatched");
-		uint32_t mismatch_cnt=0;
-		for (uint32_t i=0; i < enc->cnt.k * FFEC_N1_DEGREE; i++) {
-			if (memcmp(&enc->cells[i], &dec->cells[i], sizeof(enc->cells[0])))
-				mismatch_cnt++;
-		}
-		printf("\nmismatch %d <= %d cells\n\n", mismatch_cnt, enc->cnt.n * FFEC_N1_DEGREE);
+		printf("\nmismatch %d <= %d cells\n\n", mismatch_cnt, enc->cnt.k * FFEC_N1_DEGREE);
 	}
 
 	return err_cnt;
@@ -1,93 +1,430 @@
 /*	ffec_xor.c
 
 Performance-critical XOR code
+
+Every kernel is written once (see ffec_xor_tmpl.h) and compiled once per
+	instruction set, each copy with its own target attributes.
+This means the library does NOT need to be built with '-march=native':
+	CPU features are detected once at load time and the best set of
+	kernels is bound (see ffec_xor_ops_()).
+
+The environment variable FFEC_ISA (e.g. "FFEC_ISA=sse2") can be used to
+	force a specific (supported) instruction set;
+	useful to test and benchmark all code paths on a single machine.
 */
 
 #include <ffec.h>
+#include <stdlib.h> /* getenv() */
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define FFEC_X86
+	#include <immintrin.h>
+#endif
+
+#define FFEC_PASTE_(a, b) a ## _ ## b
+#define FFEC_PASTE(a, b) FFEC_PASTE_(a, b)
+
+/* prefetch distance (and granularity) of all kernels, in Bytes */
+#define FFEC_PREFETCH 256
+
+/* Symbol lengths for which kernels are specialized at compile time
+	(set with the 'sym_sizes' meson option).
+Each must be a multiple of FFEC_SYM_ALIGN.
+*/
+#ifndef FFEC_SYM_SIZES
+	#define FFEC_SYM_SIZES(X) X(1024) X(1280) X(4096) X(8192)
+#endif
+
+/*	ffec_xor_sized_
+Kernels specialized for one symbol length.
+*/
+struct ffec_xor_sized_ {
+	uint32_t		sym_len;
+	struct ffec_xor_ops	ops;
+};
+
+
+/* CRC32C (Castagnoli), reflected polynomial */
+#define FFEC_CRC32C_POLY 0x82f63b78U
+static uint32_t crc32c_table[256];
+
+/*	ffec_crc32c_sw_()
+Update 'crc' with 'len' Bytes at 'ptr', one Byte at a time.
+Used by instruction sets without a CRC32C instruction.
+*/
+static inline __attribute__((always_inline))
+uint32_t ffec_crc32c_sw_	(uint32_t crc, const void *ptr, size_t len)
+{
+	const uint8_t *b = ptr;
+	for (size_t i=0; i < len; i++)
+		crc = crc32c_table[(crc ^ b[i]) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+/*	ffec_crc32c_hw_()
+Update 'crc' with 'len' Bytes at 'ptr', using the SSE4.2 CRC32 instruction
+	(implied by AVX2 and AVX-512).
+*/
+static inline __attribute__((always_inline, target("sse4.2")))
+uint32_t ffec_crc32c_hw_	(uint32_t crc, const void *ptr, size_t len)
+{
+	uint64_t c = crc;
+	for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t), ptr += sizeof(uint64_t)) {
+		uint64_t v;
+		memcpy(&v, ptr, sizeof(v));
+		c = _mm_crc32_u64(c, v);
+	}
+	for (; len; len--, ptr++)
+		c = _mm_crc32_u8(c, *(const uint8_t *)ptr);
+	return c;
+}
+#endif
+
+
+/*	ffec_xor_gather_tail_()
+Tail of ffec_xor_gather_impl_[isa](): Bytes 'off' to 'sym_len',
+	fewer than one vector, one word at a time.
+*/
+static inline __attribute__((always_inline))
+void	ffec_xor_gather_tail_	(const void *const *from, uint32_t cnt,
+				void *to, void *copy,
+				uint32_t off, uint32_t sym_len)
+{
+	for (; off + sizeof(uint64_t) <= sym_len; off += sizeof(uint64_t)) {
+		uint64_t acc = 0, v;
+		for (uint32_t s=0; s < cnt; s++) {
+			memcpy(&v, from[s] + off, sizeof(v));
+			acc ^= v;
+		}
+		memcpy(to + off, &acc, sizeof(acc));
+		if (copy)
+			memcpy(copy + off, &acc, sizeof(acc));
+	}
+	for (; off < sym_len; off++) {
+		uint8_t acc = 0;
+		for (uint32_t s=0; s < cnt; s++)
+			acc ^= ((const uint8_t *)from[s])[off];
+		((uint8_t *)to)[off] = acc;
+		if (copy)
+			((uint8_t *)copy)[off] = acc;
+	}
+}
 
-/*	ffec_xor_into_symbol_()
-XOR 2 symbols, in blocks of FFEC_SYM_ALIGN bytes.
+/*	ffec_xor_scatter_tail_()
+Tail of ffec_xor_scatter_impl_[isa](): Bytes 'off' to 'sym_len',
+	fewer than one vector, one word at a time.
 */
-void	__attribute__((hot))
-	__attribute__((regparm(3)))
-#ifdef __GCC__
-	__attribute__((optimize("O3")))
-	__attribute__((optimize("unroll-loops")))
+static inline __attribute__((always_inline))
+void	ffec_xor_scatter_tail_	(const void *from, void *copy,
+				void *const *to, uint32_t cnt,
+				uint32_t off, uint32_t sym_len)
+{
+	for (; off + sizeof(uint64_t) <= sym_len; off += sizeof(uint64_t)) {
+		uint64_t src, v;
+		memcpy(&src, from + off, sizeof(src));
+		if (copy)
+			memcpy(copy + off, &src, sizeof(src));
+		for (uint32_t d=0; d < cnt; d++) {
+			memcpy(&v, to[d] + off, sizeof(v));
+			v ^= src;
+			memcpy(to[d] + off, &v, sizeof(v));
+		}
+	}
+	for (; off < sym_len; off++) {
+		uint8_t src = ((const uint8_t *)from)[off];
+		if (copy)
+			((uint8_t *)copy)[off] = src;
+		for (uint32_t d=0; d < cnt; d++)
+			((uint8_t *)to[d])[off] ^= src;
+	}
+}
+
+
+/*	ffec_scalar_load_()
+Unaligned: through memcpy(), which compiles to a plain load
+	where the target allows it (dereferencing would be undefined).
+*/
+NLC_INLINE uintmax_t	ffec_scalar_load_(const void *ptr)
+{
+	uintmax_t vec;
+	memcpy(&vec, ptr, sizeof(vec));
+	return vec;
+}
+
+/*	ffec_scalar_store_()
+*/
+NLC_INLINE void		ffec_scalar_store_(void *ptr, uintmax_t vec)
+{
+	memcpy(ptr, &vec, sizeof(vec));
+}
+
+/*
+	scalar: portable, relies on the compiler unrolling the loop
+*/
+#define FFEC_ISA		scalar
+#define FFEC_ISA_TARGET
+#define ffec_vec_t		uintmax_t
+#define FFEC_VLOAD(ptr)		ffec_scalar_load_(ptr)
+#define FFEC_VSTORE(ptr, vec)	ffec_scalar_store_((ptr), (vec))
+#define FFEC_VXOR(a, b)		((a) ^ (b))
+#define FFEC_VLOADA(ptr)	(*(const uintmax_t *)(ptr))
+#define FFEC_VSTOREA(ptr, vec)	(*(uintmax_t *)(ptr) = (vec))
+#include "ffec_xor_tmpl.h"
+
+
+#ifdef FFEC_X86
+/*
+	SSE2: XMM registers; baseline for any x86_64
+*/
+#define FFEC_ISA		sse2
+#define FFEC_ISA_TARGET		__attribute__((target("sse2")))
+#define ffec_vec_t		__m128i
+#define FFEC_VLOAD(ptr)		_mm_loadu_si128((const __m128i *)(ptr))
+#define FFEC_VSTORE(ptr, vec)	_mm_storeu_si128((__m128i *)(ptr), (vec))
+#define FFEC_VXOR(a, b)		_mm_xor_si128((a), (b))
+#define FFEC_VLOADA(ptr)	_mm_load_si128((const __m128i *)(ptr))
+#define FFEC_VSTOREA(ptr, vec)	_mm_store_si128((__m128i *)(ptr), (vec))
+#define FFEC_VSTREAM(ptr, vec)	_mm_stream_si128((__m128i *)(ptr), (vec))
+#define FFEC_VFENCE()		_mm_sfence()
+#include "ffec_xor_tmpl.h"
+
+/*
+	AVX2: YMM registers
+*/
+#define FFEC_ISA		avx2
+#define FFEC_ISA_TARGET		__attribute__((target("avx2")))
+#define ffec_vec_t		__m256i
+#define FFEC_VLOAD(ptr)		_mm256_loadu_si256((const __m256i *)(ptr))
+#define FFEC_VSTORE(ptr, vec)	_mm256_storeu_si256((__m256i *)(ptr), (vec))
+#define FFEC_VXOR(a, b)		_mm256_xor_si256((a), (b))
+#define FFEC_VLOADA(ptr)	_mm256_load_si256((const __m256i *)(ptr))
+#define FFEC_VSTOREA(ptr, vec)	_mm256_store_si256((__m256i *)(ptr), (vec))
+#ifdef __x86_64__
+	#define FFEC_CRC32C(crc, ptr, len) ffec_crc32c_hw_(crc, ptr, len)
+#endif
+#define FFEC_VSTREAM(ptr, vec)	_mm256_stream_si256((__m256i *)(ptr), (vec))
+#define FFEC_VFENCE()		_mm_sfence()
+#include "ffec_xor_tmpl.h"
+
+/*
+	AVX-512: ZMM registers
+*/
+#define FFEC_ISA		avx512
+#define FFEC_ISA_TARGET		__attribute__((target("avx512f")))
+#define ffec_vec_t		__m512i
+#define FFEC_VLOAD(ptr)		_mm512_loadu_si512((const void *)(ptr))
+#define FFEC_VSTORE(ptr, vec)	_mm512_storeu_si512((void *)(ptr), (vec))
+#define FFEC_VXOR(a, b)		_mm512_xor_si512((a), (b))
+#define FFEC_VLOADA(ptr)	_mm512_load_si512((const void *)(ptr))
+#define FFEC_VSTOREA(ptr, vec)	_mm512_store_si512((void *)(ptr), (vec))
+#ifdef __x86_64__
+	#define FFEC_CRC32C(crc, ptr, len) ffec_crc32c_hw_(crc, ptr, len)
+#endif
+/* vpternlogq: truth table 0x96 is a ^ b ^ c */
+#define FFEC_VXOR3(a, b, c)	_mm512_ternarylogic_epi64((a), (b), (c), 0x96)
+#define FFEC_VSTREAM(ptr, vec)	_mm512_stream_si512((void *)(ptr), (vec))
+#define FFEC_VFENCE()		_mm_sfence()
+#include "ffec_xor_tmpl.h"
+#endif /* FFEC_X86 */
+
+
+/*	ffec_isa_
+One set of kernels, and how to tell whether the CPU can run them.
+*/
+struct ffec_isa_ {
+	const char		*name;
+	int			(*supported)(void);
+	struct ffec_xor_ops	ops[2]; /* [aligned] */
+	const struct ffec_xor_sized_ *sized; /* aligned, by length */
+};
+
+static int	ffec_isa_scalar_	(void)
+{
+	return 1;
+}
+
+#ifdef FFEC_X86
+static int	ffec_isa_sse2_		(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+static int	ffec_isa_avx2_		(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+static int	ffec_isa_avx512_	(void)
+{
+	return __builtin_cpu_supports("avx512f");
+}
 #endif
-	ffec_xor_into_symbol_	(const void *from, void *to, uint32_t sym_len)
-{
-	uint32_t i;
-	for (i=0; i < sym_len / FFEC_SYM_ALIGN; i++) {
-		__builtin_prefetch(from + FFEC_SYM_ALIGN, 0, 0);
-		__builtin_prefetch(to + FFEC_SYM_ALIGN, 1, 0);
-
-/* AVX-specific: speeeeed */
-#ifdef __AVX__
-		asm (
-			/* vlddqu replaced with vmovdqu for speed */
-			"vmovdqu	0x0(%[src]),	%%ymm8;"
-			"vmovdqu	0x0(%[dst]),	%%ymm0;"
-			"vpxor		%%ymm0,		%%ymm8,		%%ymm0;"
-			"vmovdqu	%%ymm0,		0x0(%[dst]);"
-
-			"vmovdqu	0x20(%[src]),	%%ymm9;"
-			"vmovdqu	0x20(%[dst]),	%%ymm1;"
-			"vpxor		%%ymm1,		%%ymm9,		%%ymm1;"
-			"vmovdqu	%%ymm1,		0x20(%[dst]);"
-
-			"vmovdqu	0x40(%[src]),	%%ymm10;"
-			"vmovdqu	0x40(%[dst]),	%%ymm2;"
-			"vpxor		%%ymm2,		%%ymm10,	%%ymm2;"
-			"vmovdqu	%%ymm2,		0x40(%[dst]);"
-
-			"vmovdqu	0x60(%[src]),	%%ymm11;"
-			"vmovdqu	0x60(%[dst]),	%%ymm3;"
-			"vpxor		%%ymm3,		%%ymm11,	%%ymm3;"
-			"vmovdqu	%%ymm3,		0x60(%[dst]);"
-
-			"vmovdqu	0x80(%[src]),	%%ymm12;"
-			"vmovdqu	0x80(%[dst]),	%%ymm4;"
-			"vpxor		%%ymm4,		%%ymm12,	%%ymm4;"
-			"vmovdqu	%%ymm4,		0x80(%[dst]);"
-
-			"vmovdqu	0xA0(%[src]),	%%ymm13;"
-			"vmovdqu	0xA0(%[dst]),	%%ymm5;"
-			"vpxor		%%ymm5,		%%ymm13,	%%ymm5;"
-			"vmovdqu	%%ymm5,		0xA0(%[dst]);"
-
-			"vmovdqu	0xC0(%[src]),	%%ymm14;"
-			"vmovdqu	0xC0(%[dst]),	%%ymm6;"
-			"vpxor		%%ymm6,		%%ymm14,	%%ymm6;"
-			"vmovdqu	%%ymm6,		0xC0(%[dst]);"
-
-			"vmovdqu	0xE0(%[src]),	%%ymm15;"
-			"vmovdqu	0xE0(%[dst]),	%%ymm7;"
-			"vpxor		%%ymm7,		%%ymm15,	%%ymm7;"
-			"vmovdqu	%%ymm7,		0xE0(%[dst]);"
-
-			:						/* output */
-			: [src] "r" (from), [dst] "r" (to)		/* input */
-			/* TODO: how to prove that not adding "memory" as a clobber
-				(which slows things down!) is SAFE?
-			*/
-			:						/* clobber */
-		);
-
-/* This is the non-AVX approach for portability.
-Rely on compiler unrolling loop for speed.
-*/
-#else
-		const uintmax_t *p_f = from;
-		uintmax_t *p_t = to;
-		#ifndef __GNUC__
-			#pragma unroll (FFEC_SYM_ALIGN / sizeof(uintmax_t))
-		#endif
-		#pragma GCC ivdep
-		for (int i=0; i < FFEC_SYM_ALIGN / sizeof(uintmax_t); i++)
-			p_t[i] ^= p_f[i];
+
+#define FFEC_OPS_ENTRY(isa, al) {					\
+	.into_symbol = ffec_xor_into_symbol ## al ## _ ## isa,		\
+	.gather = ffec_xor_gather ## al ## _ ## isa,			\
+	.gather_nt = ffec_xor_gather_nt ## al ## _ ## isa,		\
+	.scatter = ffec_xor_scatter ## al ## _ ## isa,			\
+	.copy_scatter = ffec_xor_copy_scatter ## al ## _ ## isa,	\
+	.copy_scatter_nt = ffec_xor_copy_scatter_nt ## al ## _ ## isa,	\
+	.scatter_crc = ffec_xor_scatter_crc ## al ## _ ## isa		\
+}
+#define FFEC_ISA_ENTRY(isa) {					\
+	.name = #isa,						\
+	.supported = ffec_isa_ ## isa ## _,			\
+	.ops = { FFEC_OPS_ENTRY(isa, ), FFEC_OPS_ENTRY(isa, _a) },	\
+	.sized = ffec_xor_sized_ ## isa				\
+}
+
+/* ordered from least to most preferred */
+static const struct ffec_isa_ isas[] = {
+	FFEC_ISA_ENTRY(scalar),
+#ifdef FFEC_X86
+	FFEC_ISA_ENTRY(sse2),
+	FFEC_ISA_ENTRY(avx2),
+	FFEC_ISA_ENTRY(avx512),
 #endif
+};
+#define FFEC_ISA_CNT (sizeof(isas) / sizeof(isas[0]))
+
+/* currently bound; never NULL so that callers need no checks */
+static const struct ffec_isa_ *isa_bound = &isas[0];
+
+
+/*	ffec_xor_bind()
+Bind the kernels for instruction set 'isa' (e.g. "avx2").
+If 'isa' is NULL, bind the best set of kernels this CPU supports.
+
+NOTE: NOT thread-safe: do not call while encoding or decoding.
+NOTE: an ffec_instance keeps using the kernels bound when it was created
+	(see ffec_xor_ops_()).
+
+returns 0 on success, or non-zero if 'isa' is unknown or not supported
+	by this CPU (in which case the previous binding is left in place).
+*/
+int		ffec_xor_bind	(const char *isa)
+{
+	int err_cnt = 0;
+	const struct ffec_isa_ *bind = NULL;
+
+	for (unsigned int i=0; i < FFEC_ISA_CNT; i++) {
+		if (!isas[i].supported())
+			continue;
+		if (!isa || !strcmp(isa, isas[i].name))
+			bind = &isas[i];
+	}
+	NB_die_if(!bind, "instruction set '%s' unknown or not supported", isa);
+
+	isa_bound = bind;
+	NB_wrn("bound XOR kernels: %s", isa_bound->name);
+
+die:
+	return err_cnt;
+}
+
+
+/*	ffec_xor_ops_()
+Returns the currently bound kernels for symbols of 'sym_len' Bytes:
+	if 'aligned', the variants which REQUIRE every symbol address
+	and the symbol length to be multiples of FFEC_SYM_ALIGN
+	(as is the case for all symbols of an instance with fi->aligned set),
+	specialized for 'sym_len' if it is one of FFEC_SYM_SIZES.
+*/
+const struct ffec_xor_ops *ffec_xor_ops_(uint32_t sym_len, int aligned)
+{
+	if (aligned) {
+		for (const struct ffec_xor_sized_ *s = isa_bound->sized; s->sym_len; s++) {
+			if (s->sym_len == sym_len)
+				return &s->ops;
+		}
+	}
+	return &isa_bound->ops[!!aligned];
+}
+
 
-		from += FFEC_SYM_ALIGN;
-		to += FFEC_SYM_ALIGN;
+/*	ffec_xor_gather()
+XOR 'cnt' symbols of 'sym_len' bytes at 'from' together, write the result to 'to'.
+Each part of 'to' is accumulated in registers and written exactly once,
+	instead of the read-modify-write of 'to' per source symbol
+	which XORing one source symbol at a time would cost.
+
+To accumulate into 'to' (rather than overwrite it), pass 'to' as one of 'from'.
+*/
+void		ffec_xor_gather	(const void *const	*from,
+				uint32_t		cnt,
+				void			*to,
+				uint32_t		sym_len)
+{
+	isa_bound->ops[0].gather(from, cnt, to, sym_len);
+}
+
+
+/*	ffec_xor_scatter()
+XOR the symbol of 'sym_len' bytes at 'from' into each of the 'cnt' symbols at 'to'.
+'from' is read only once, no matter how many destinations.
+*/
+void		ffec_xor_scatter(const void		*from,
+				void *const		*to,
+				uint32_t		cnt,
+				uint32_t		sym_len)
+{
+	isa_bound->ops[0].scatter(from, to, cnt, sym_len);
+}
+
+
+/*	ffec_xor_copy_scatter()
+Copy the symbol of 'sym_len' bytes at 'from' to 'copy',
+	and XOR it into each of the 'cnt' symbols at 'to'.
+'from' is read only once: same as ffec_xor_scatter() but with an extra
+	destination which is stored rather than XORed into.
+*/
+void		ffec_xor_copy_scatter(const void	*from,
+				void			*copy,
+				void *const		*to,
+				uint32_t		cnt,
+				uint32_t		sym_len)
+{
+	isa_bound->ops[0].copy_scatter(from, copy, to, cnt, sym_len);
+}
+
+
+/*	ffec_crc32c()
+Returns the CRC32C of 'len' Bytes at 'buf',
+	as computed for each source symbol with FFEC_CRC.
+*/
+uint32_t	ffec_crc32c	(const void		*buf,
+				uint32_t		len)
+{
+	return isa_bound->ops[0].scatter_crc(buf, NULL, NULL, 0, len, 0);
+}
+
+
+/*	ffec_xor_isa()
+Returns the name of the instruction set currently bound.
+*/
+const char	*ffec_xor_isa	(void)
+{
+	return isa_bound->name;
+}
+
+
+/*	ffec_xor_init_()
+Runs at load time: fill the software CRC32C table, bind the best supported kernels,
+	unless caller forces a specific instruction set with FFEC_ISA.
+*/
+static void __attribute__((constructor))
+		ffec_xor_init_	(void)
+{
+	for (uint32_t i=0; i < 256; i++) {
+		uint32_t crc = i;
+		for (unsigned int j=0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? FFEC_CRC32C_POLY : 0);
+		crc32c_table[i] = crc;
 	}
+
+#ifdef FFEC_X86
+	__builtin_cpu_init();
+#endif
+	const char *isa = getenv("FFEC_ISA");
+	if (!isa || ffec_xor_bind(isa))
+		ffec_xor_bind(NULL);
 }
@@ -0,0 +1,110 @@
+/*	ffec_xor_entry.h
+
+Kernel entry points.
+Included by ffec_xor_tmpl.h twice per instruction set:
+-	FFEC_AL 0	: any symbol address; unaligned loads and stores
+-	FFEC_AL 1	: every symbol address and 'sym_len' are multiples of
+			sizeof(ffec_vec_t); aligned loads and stores
+			(names suffixed with '_a', see ffec_xor_ops_()).
+
+The includer must define FFEC_AL and FFEC_EN(name) (the generated function name);
+	both are undefined again at the bottom of this file.
+
+NOTE: no include guard: this file is MEANT to be included several times.
+*/
+
+
+/*	ffec_xor_gather[_a]_[isa]()
+XOR 'cnt' symbols at 'from' together, write the result to 'to'.
+*/
+static void __attribute__((hot)) FFEC_ISA_TARGET
+	FFEC_EN(ffec_xor_gather)	(const void *const *from, uint32_t cnt,
+					void *to, uint32_t sym_len)
+{
+	FFEC_FN(ffec_xor_gather_impl_)(from, cnt, to, NULL, sym_len, 0, FFEC_AL);
+}
+
+/*	ffec_xor_gather_nt[_a]_[isa]()
+XOR 'cnt' symbols at 'from' together, write the result to 'to' with streaming stores
+	(so that it does not pollute the cache) and, if 'copy' is not NULL,
+	also store it there through the cache.
+*/
+static void __attribute__((hot)) FFEC_ISA_TARGET
+	FFEC_EN(ffec_xor_gather_nt)	(const void *const *from, uint32_t cnt,
+					void *to, void *copy, uint32_t sym_len)
+{
+	if (FFEC_VALIGNED(to))
+		FFEC_FN(ffec_xor_gather_impl_)(from, cnt, to, copy, sym_len, 1, FFEC_AL);
+	else
+		FFEC_FN(ffec_xor_gather_impl_)(from, cnt, to, copy, sym_len, 0, FFEC_AL);
+}
+
+
+/*	ffec_xor_into_symbol[_a]_[isa]()
+XOR 2 symbols.
+*/
+static void __attribute__((hot)) FFEC_ISA_TARGET
+	FFEC_EN(ffec_xor_into_symbol)	(const void *from, void *to, uint32_t sym_len)
+{
+	void *const dst[1] = { to };
+	FFEC_FN(ffec_xor_scatter_impl_)(from, NULL, dst, 1, sym_len, 0, FFEC_AL, NULL);
+}
+
+/*	ffec_xor_scatter[_a]_[isa]()
+XOR the symbol at 'from' into each of the 'cnt' symbols at 'to'.
+*/
+static void __attribute__((hot)) FFEC_ISA_TARGET
+	FFEC_EN(ffec_xor_scatter)	(const void *from, void *const *to, uint32_t cnt,
+					uint32_t sym_len)
+{
+	FFEC_FN(ffec_xor_scatter_impl_)(from, NULL, to, cnt, sym_len, 0, FFEC_AL, NULL);
+}
+
+/*	ffec_xor_copy_scatter[_a]_[isa]()
+Copy the symbol at 'from' to 'copy' and XOR it into each of the 'cnt' symbols at 'to',
+	reading 'from' only once.
+*/
+static void __attribute__((hot)) FFEC_ISA_TARGET
+	FFEC_EN(ffec_xor_copy_scatter)	(const void *from, void *copy,
+					void *const *to, uint32_t cnt,
+					uint32_t sym_len)
+{
+	FFEC_FN(ffec_xor_scatter_impl_)(from, copy, to, cnt, sym_len, 0, FFEC_AL, NULL);
+}
+
+/*	ffec_xor_copy_scatter_nt[_a]_[isa]()
+As ffec_xor_copy_scatter[_a]_[isa](), but 'copy' is written with streaming stores:
+	use when 'copy' is a final destination which will not be read again soon.
+*/
+static void __attribute__((hot)) FFEC_ISA_TARGET
+	FFEC_EN(ffec_xor_copy_scatter_nt)(const void *from, void *copy,
+					void *const *to, uint32_t cnt,
+					uint32_t sym_len)
+{
+	if (FFEC_VALIGNED(copy))
+		FFEC_FN(ffec_xor_scatter_impl_)(from, copy, to, cnt, sym_len, 1, FFEC_AL, NULL);
+	else
+		FFEC_FN(ffec_xor_scatter_impl_)(from, copy, to, cnt, sym_len, 0, FFEC_AL, NULL);
+}
+
+
+/*	ffec_xor_scatter_crc[_a]_[isa]()
+As ffec_xor_copy_scatter[_a]_[isa]() ('copy' MAY be NULL),
+	or ffec_xor_copy_scatter_nt[_a]_[isa]() if 'nt',
+	and return the CRC32C of 'from', computed in the same pass.
+*/
+static uint32_t __attribute__((hot)) FFEC_ISA_TARGET
+	FFEC_EN(ffec_xor_scatter_crc)	(const void *from, void *copy,
+					void *const *to, uint32_t cnt,
+					uint32_t sym_len, int nt)
+{
+	uint32_t crc = ~0U;
+	if (nt && copy && FFEC_VALIGNED(copy))
+		FFEC_FN(ffec_xor_scatter_impl_)(from, copy, to, cnt, sym_len, 1, FFEC_AL, &crc);
+	else
+		FFEC_FN(ffec_xor_scatter_impl_)(from, copy, to, cnt, sym_len, 0, FFEC_AL, &crc);
+	return ~crc;
+}
+
+#undef FFEC_EN
+#undef FFEC_AL
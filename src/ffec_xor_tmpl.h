@@ -0,0 +1,340 @@
+/*	ffec_xor_tmpl.h
+
+XOR kernel template.
+Included by ffec_xor.c once per instruction set, so that every kernel
+	is written only once but compiled with its own target attributes.
+
+The includer must define:
+-	FFEC_ISA		: suffix for the generated function names (e.g. 'avx2')
+-	FFEC_ISA_TARGET		: function attributes selecting the instruction set
+-	ffec_vec_t		: vector type (a register's worth of data)
+-	FFEC_VLOAD(ptr)		: unaligned load of one vector
+-	FFEC_VSTORE(ptr, vec)	: unaligned store of one vector
+-	FFEC_VXOR(a, b)		: return a ^ b
+... and optionally:
+-	FFEC_VXOR3(a, b, c)	: return a ^ b ^ c (in one instruction)
+-	FFEC_VSTREAM(ptr, vec)	: non-temporal (streaming) store of one vector;
+				'ptr' is aligned to sizeof(ffec_vec_t)
+-	FFEC_VFENCE()		: order streaming stores before any later stores
+-	FFEC_VLOADA(ptr)	: aligned load of one vector
+-	FFEC_VSTOREA(ptr, vec)	: aligned store of one vector
+-	FFEC_CRC32C(crc, ptr, len) : update CRC32C 'crc' with 'len' Bytes at 'ptr'
+
+All of these are undefined again at the bottom of this file.
+
+Entry points (unaligned and aligned) are generated by ffec_xor_entry.h.
+
+Shared by all instruction sets (see ffec_xor.c):
+	FFEC_PREFETCH, FFEC_SYM_SIZES, struct ffec_xor_sized_,
+	ffec_xor_gather_tail_(), ffec_xor_scatter_tail_() and ffec_crc32c_sw_().
+
+NOTE: no include guard: this file is MEANT to be included several times.
+*/
+
+/* number of vectors accumulated in registers at once by multi-operand kernels */
+#define FFEC_ACNT 4
+/* Bytes in one stripe of FFEC_ACNT vectors */
+#define FFEC_STRIPE (FFEC_ACNT * sizeof(ffec_vec_t))
+/* generated function names: [name]_[isa] */
+#define FFEC_FN(name) FFEC_PASTE(name, FFEC_ISA)
+
+/* no streaming stores: plain stores */
+#ifndef FFEC_VSTREAM
+	#define FFEC_VSTREAM(ptr, vec) FFEC_VSTORE(ptr, vec)
+	#define FFEC_VFENCE()
+#endif
+/* no aligned loads/stores: unaligned ones will do */
+#ifndef FFEC_VLOADA
+	#define FFEC_VLOADA(ptr) FFEC_VLOAD(ptr)
+	#define FFEC_VSTOREA(ptr, vec) FFEC_VSTORE(ptr, vec)
+#endif
+/* aligned (if 'al') or unaligned load and store */
+#define FFEC_VLD(al, ptr) ((al) ? FFEC_VLOADA(ptr) : FFEC_VLOAD(ptr))
+#define FFEC_VST(al, ptr, vec)			\
+	do {					\
+		if (al)				\
+			FFEC_VSTOREA(ptr, vec);	\
+		else				\
+			FFEC_VSTORE(ptr, vec);	\
+	} while (0)
+/* no CRC32C instruction: table-driven */
+#ifndef FFEC_CRC32C
+	#define FFEC_CRC32C(crc, ptr, len) ffec_crc32c_sw_(crc, ptr, len)
+#endif
+/* streaming stores are only possible to aligned addresses */
+#define FFEC_VALIGNED(ptr) (!((uintptr_t)(ptr) % sizeof(ffec_vec_t)))
+
+
+/*	ffec_xor_gather_vec_[isa]()
+Gather 'vcnt' (at most FFEC_ACNT) vectors at offset 'at' of each symbol.
+'vcnt' is always a constant: the loops below unroll completely.
+*/
+static inline __attribute__((always_inline)) FFEC_ISA_TARGET
+void	FFEC_FN(ffec_xor_gather_vec_)	(const void *const *from, uint32_t cnt,
+					void *to, void *copy, size_t at,
+					const unsigned int vcnt, const int nt, const int al)
+{
+	ffec_vec_t acc[FFEC_ACNT];
+
+	#pragma GCC unroll 4
+	for (unsigned int j=0; j < vcnt; j++)
+		acc[j] = FFEC_VLD(al, from[0] + at + j * sizeof(ffec_vec_t));
+
+	uint32_t s = 1;
+#ifdef FFEC_VXOR3
+	/* two sources per instruction */
+	for (; s + 1 < cnt; s += 2) {
+		#pragma GCC unroll 4
+		for (unsigned int j=0; j < vcnt; j++)
+			acc[j] = FFEC_VXOR3(acc[j],
+				FFEC_VLD(al, from[s] + at + j * sizeof(ffec_vec_t)),
+				FFEC_VLD(al, from[s+1] + at + j * sizeof(ffec_vec_t)));
+	}
+#endif
+	for (; s < cnt; s++) {
+		#pragma GCC unroll 4
+		for (unsigned int j=0; j < vcnt; j++)
+			acc[j] = FFEC_VXOR(acc[j],
+				FFEC_VLD(al, from[s] + at + j * sizeof(ffec_vec_t)));
+	}
+
+	#pragma GCC unroll 4
+	for (unsigned int j=0; j < vcnt; j++) {
+		if (nt)
+			FFEC_VSTREAM(to + at + j * sizeof(ffec_vec_t), acc[j]);
+		else
+			FFEC_VST(al, to + at + j * sizeof(ffec_vec_t), acc[j]);
+		if (copy)
+			FFEC_VST(al, copy + at + j * sizeof(ffec_vec_t), acc[j]);
+	}
+}
+
+/*	ffec_xor_gather_impl_[isa]()
+XOR 'cnt' symbols at 'from' together, write the result to 'to'
+	(with streaming stores if 'nt') and, if 'copy' is not NULL, also store it there.
+Each vector of 'to' is accumulated in registers and written exactly once.
+'to' and 'copy' MAY be among the 'from' symbols (to accumulate into them).
+
+Any 'sym_len' is handled: whole stripes of FFEC_ACNT vectors,
+	then single vectors, then a tail shorter than one vector.
+*/
+static inline __attribute__((always_inline)) FFEC_ISA_TARGET
+void	FFEC_FN(ffec_xor_gather_impl_)	(const void *const *from, uint32_t cnt,
+					void *to, void *copy,
+					uint32_t sym_len, const int nt, const int al)
+{
+	if (!cnt) {
+		memset(to, 0x0, sym_len);
+		if (copy)
+			memset(copy, 0x0, sym_len);
+		return;
+	}
+
+	uint32_t off = 0;
+	for (; off + FFEC_STRIPE <= sym_len; off += FFEC_STRIPE) {
+		/* no point prefetching past the end of the symbol */
+		if (!(off % FFEC_PREFETCH) && off + FFEC_PREFETCH < sym_len) {
+			for (uint32_t s=0; s < cnt; s++)
+				__builtin_prefetch(from[s] + off + FFEC_PREFETCH, 0, 0);
+			if (!nt)
+				__builtin_prefetch(to + off + FFEC_PREFETCH, 1, 0);
+		}
+		FFEC_FN(ffec_xor_gather_vec_)(from, cnt, to, copy, off, FFEC_ACNT, nt, al);
+	}
+	for (; off + sizeof(ffec_vec_t) <= sym_len; off += sizeof(ffec_vec_t))
+		FFEC_FN(ffec_xor_gather_vec_)(from, cnt, to, copy, off, 1, nt, al);
+	if (off < sym_len)
+		ffec_xor_gather_tail_(from, cnt, to, copy, off, sym_len);
+
+	if (nt)
+		FFEC_VFENCE();
+}
+
+/*	ffec_xor_scatter_vec_[isa]()
+Scatter 'vcnt' (at most FFEC_ACNT) vectors at offset 'at' of 'from'.
+'vcnt' is always a constant: the loops below unroll completely.
+*/
+static inline __attribute__((always_inline)) FFEC_ISA_TARGET
+void	FFEC_FN(ffec_xor_scatter_vec_)	(const void *from, void *copy,
+					void *const *to, uint32_t cnt, size_t at,
+					const unsigned int vcnt, const int nt, const int al)
+{
+	ffec_vec_t src[FFEC_ACNT];
+
+	#pragma GCC unroll 4
+	for (unsigned int j=0; j < vcnt; j++)
+		src[j] = FFEC_VLD(al, from + at + j * sizeof(ffec_vec_t));
+
+	if (copy) {
+		#pragma GCC unroll 4
+		for (unsigned int j=0; j < vcnt; j++) {
+			if (nt)
+				FFEC_VSTREAM(copy + at + j * sizeof(ffec_vec_t), src[j]);
+			else
+				FFEC_VST(al, copy + at + j * sizeof(ffec_vec_t), src[j]);
+		}
+	}
+
+	for (uint32_t d=0; d < cnt; d++) {
+		#pragma GCC unroll 4
+		for (unsigned int j=0; j < vcnt; j++) {
+			void *dst = to[d] + at + j * sizeof(ffec_vec_t);
+			FFEC_VST(al, dst, FFEC_VXOR(src[j], FFEC_VLD(al, dst)));
+		}
+	}
+}
+
+/*	ffec_xor_scatter_impl_[isa]()
+XOR the symbol at 'from' into each of the 'cnt' symbols at 'to'
+	and, if 'copy' is not NULL, also store it there
+	(with streaming stores if 'nt').
+Each vector of 'from' is loaded once and kept in registers
+	while it is written to all destinations.
+The same destination MAY appear more than once (and will be XORed more than once).
+If 'crc' is not NULL, update it with the CRC32C of 'from',
+	one stripe at a time while that stripe is still in L1.
+
+Any 'sym_len' is handled, as in ffec_xor_gather_impl_[isa]().
+*/
+static inline __attribute__((always_inline)) FFEC_ISA_TARGET
+void	FFEC_FN(ffec_xor_scatter_impl_)	(const void *from, void *copy,
+					void *const *to, uint32_t cnt,
+					uint32_t sym_len, const int nt, const int al,
+					uint32_t *crc)
+{
+	uint32_t off = 0;
+	for (; off + FFEC_STRIPE <= sym_len; off += FFEC_STRIPE) {
+		if (!(off % FFEC_PREFETCH) && off + FFEC_PREFETCH < sym_len) {
+			__builtin_prefetch(from + off + FFEC_PREFETCH, 0, 0);
+			for (uint32_t d=0; d < cnt; d++)
+				__builtin_prefetch(to[d] + off + FFEC_PREFETCH, 1, 0);
+		}
+		FFEC_FN(ffec_xor_scatter_vec_)(from, copy, to, cnt, off, FFEC_ACNT, nt, al);
+		if (crc)
+			*crc = FFEC_CRC32C(*crc, from + off, FFEC_STRIPE);
+	}
+	for (; off + sizeof(ffec_vec_t) <= sym_len; off += sizeof(ffec_vec_t)) {
+		FFEC_FN(ffec_xor_scatter_vec_)(from, copy, to, cnt, off, 1, nt, al);
+		if (crc)
+			*crc = FFEC_CRC32C(*crc, from + off, sizeof(ffec_vec_t));
+	}
+	if (off < sym_len) {
+		ffec_xor_scatter_tail_(from, copy, to, cnt, off, sym_len);
+		if (crc)
+			*crc = FFEC_CRC32C(*crc, from + off, sym_len - off);
+	}
+
+	if (nt)
+		FFEC_VFENCE();
+}
+
+/* entry points: unaligned, then aligned */
+#define FFEC_AL 0
+#define FFEC_EN(name) FFEC_FN(name)
+#include "ffec_xor_entry.h"
+
+#define FFEC_AL 1
+#define FFEC_EN(name) FFEC_FN(name ## _a)
+#include "ffec_xor_entry.h"
+
+
+/* Entry points specialized for each length in FFEC_SYM_SIZES:
+	aligned only, with 'sym_len' (the argument is ignored) a constant.
+	No tail, and every loop bound and prefetch is resolved at compile time.
+*/
+#define FFEC_SIZED_FN(len)							\
+_Static_assert(len && !(len % FFEC_SYM_ALIGN),					\
+	"FFEC_SYM_SIZES: " #len " not a multiple of FFEC_SYM_ALIGN");		\
+static void __attribute__((hot)) FFEC_ISA_TARGET				\
+	FFEC_FN(ffec_xor_gather_ ## len)	(const void *const *from, uint32_t cnt,	\
+						void *to, uint32_t sym_len)	\
+{										\
+	FFEC_FN(ffec_xor_gather_impl_)(from, cnt, to, NULL, len, 0, 1);	\
+}										\
+static void __attribute__((hot)) FFEC_ISA_TARGET				\
+	FFEC_FN(ffec_xor_gather_nt_ ## len)	(const void *const *from, uint32_t cnt,	\
+						void *to, void *copy, uint32_t sym_len)	\
+{										\
+	FFEC_FN(ffec_xor_gather_impl_)(from, cnt, to, copy, len, 1, 1);	\
+}										\
+static void __attribute__((hot)) FFEC_ISA_TARGET				\
+	FFEC_FN(ffec_xor_into_symbol_ ## len)	(const void *from, void *to,	\
+						uint32_t sym_len)		\
+{										\
+	void *const dst[1] = { to };						\
+	FFEC_FN(ffec_xor_scatter_impl_)(from, NULL, dst, 1, len, 0, 1, NULL);	\
+}										\
+static void __attribute__((hot)) FFEC_ISA_TARGET				\
+	FFEC_FN(ffec_xor_scatter_ ## len)	(const void *from, void *const *to,	\
+						uint32_t cnt, uint32_t sym_len)	\
+{										\
+	FFEC_FN(ffec_xor_scatter_impl_)(from, NULL, to, cnt, len, 0, 1, NULL);	\
+}										\
+static void __attribute__((hot)) FFEC_ISA_TARGET				\
+	FFEC_FN(ffec_xor_copy_scatter_ ## len)	(const void *from, void *copy,	\
+						void *const *to, uint32_t cnt,	\
+						uint32_t sym_len)		\
+{										\
+	FFEC_FN(ffec_xor_scatter_impl_)(from, copy, to, cnt, len, 0, 1, NULL);	\
+}										\
+static void __attribute__((hot)) FFEC_ISA_TARGET				\
+	FFEC_FN(ffec_xor_copy_scatter_nt_ ## len)(const void *from, void *copy,	\
+						void *const *to, uint32_t cnt,	\
+						uint32_t sym_len)		\
+{										\
+	FFEC_FN(ffec_xor_scatter_impl_)(from, copy, to, cnt, len, 1, 1, NULL);	\
+}										\
+static uint32_t __attribute__((hot)) FFEC_ISA_TARGET				\
+	FFEC_FN(ffec_xor_scatter_crc_ ## len)	(const void *from, void *copy,	\
+						void *const *to, uint32_t cnt,	\
+						uint32_t sym_len, int nt)	\
+{										\
+	uint32_t crc = ~0U;							\
+	if (nt && copy)								\
+		FFEC_FN(ffec_xor_scatter_impl_)(from, copy, to, cnt, len, 1, 1, &crc);	\
+	else									\
+		FFEC_FN(ffec_xor_scatter_impl_)(from, copy, to, cnt, len, 0, 1, &crc);	\
+	return ~crc;								\
+}
+FFEC_SYM_SIZES(FFEC_SIZED_FN)
+
+/* ffec_xor_sized_[isa]: one entry per length, terminated by a 0 length */
+#define FFEC_SIZED_OPS(len) {							\
+	.sym_len = len,								\
+	.ops = {								\
+		.into_symbol = FFEC_FN(ffec_xor_into_symbol_ ## len),		\
+		.gather = FFEC_FN(ffec_xor_gather_ ## len),			\
+		.gather_nt = FFEC_FN(ffec_xor_gather_nt_ ## len),		\
+		.scatter = FFEC_FN(ffec_xor_scatter_ ## len),			\
+		.copy_scatter = FFEC_FN(ffec_xor_copy_scatter_ ## len),		\
+		.copy_scatter_nt = FFEC_FN(ffec_xor_copy_scatter_nt_ ## len),	\
+		.scatter_crc = FFEC_FN(ffec_xor_scatter_crc_ ## len)		\
+	}									\
+},
+static const struct ffec_xor_sized_ FFEC_FN(ffec_xor_sized)[] = {
+	FFEC_SYM_SIZES(FFEC_SIZED_OPS)
+	{ .sym_len = 0 }
+};
+
+
+#undef FFEC_SIZED_OPS
+#undef FFEC_SIZED_FN
+#undef FFEC_FN
+#undef FFEC_VALIGNED
+#undef FFEC_CRC32C
+#undef FFEC_VLD
+#undef FFEC_VST
+#undef FFEC_STRIPE
+#undef FFEC_ACNT
+
+#undef FFEC_ISA
+#undef FFEC_ISA_TARGET
+#undef ffec_vec_t
+#undef FFEC_VLOAD
+#undef FFEC_VSTORE
+#undef FFEC_VXOR
+#undef FFEC_VXOR3
+#undef FFEC_VSTREAM
+#undef FFEC_VFENCE
+#undef FFEC_VLOADA
+#undef FFEC_VSTOREA
@@ -0,0 +1,173 @@
+/*	ffec_ingest_test.c
+
+Decode one block fed by several "receive" threads at once (ffec_ingest()),
+	while the main thread drains and decodes (ffec_ingest_drain()).
+Each thread sends an interleaved share of the transmit sequence,
+	plus some duplicates of symbols sent by other threads.
+
+-c	:	check CRC32C (FFEC_CRC), and have a corrupt symbol rejected
+
+Decoded symbols go to an output sink (ffec_sink_init()) as they are final.
+*/
+
+#include <ffec.h>
+
+#include <pthread.h>
+#include <sched.h> /* sched_yield() */
+#include <nonlibc.h>
+#include <nlc_urand.h>
+#include <fnv.h>
+
+#include "ffec_sink_check.h"
+
+
+#define THREADS 4
+
+static const size_t original_sz = 12801280;	/* 12.8MB */
+static struct ffec_params fp = {
+	.fec_ratio = 1.1,
+	.sym_len = 1280
+};
+
+
+struct rx_thread {
+	pthread_t		tid;
+	unsigned int		id;
+	struct ffec_instance	*fi_enc;
+	struct ffec_instance	*fi_dec;
+	uint32_t		queued;
+	uint32_t		dropped;
+	uint32_t		failed;
+};
+
+
+/*	random_bytes()
+*/
+void random_bytes(void *region, size_t size)
+{
+	uint64_t seeds[2] = { 0 };
+	while (nlc_urand(seeds, sizeof(seeds)) != sizeof(seeds))
+		usleep(10000);
+	pcg_randset(region, size, seeds[0], seeds[1]);
+}
+
+
+/*	rx_run()
+*/
+void *rx_run(void *arg)
+{
+	struct rx_thread *rx = arg;
+	for (uint32_t i = rx->id; i < rx->fi_enc->cnt.n; i += THREADS) {
+		/* every so often, also "receive" the one sent by the next thread */
+		uint32_t dup = (i % 97 < THREADS && i +1 < rx->fi_enc->cnt.n) ? 2 : 1;
+		for (uint32_t d=0; d < dup; d++) {
+			switch (ffec_ingest(&fp, rx->fi_dec, ffec_enc_seq(&fp, rx->fi_enc, i + d))) {
+			case 0:
+				rx->queued++;
+				break;
+			case 1:
+				rx->dropped++;
+				break;
+			default:
+				rx->failed++;
+			}
+		}
+	}
+	return NULL;
+}
+
+
+/*	main()
+*/
+int main(int argc, char **argv)
+{
+	int err_cnt = 0;
+	void *mem = NULL, *bad = NULL;
+	struct ffec_instance *fi_enc = NULL, *fi_dec = NULL;
+	struct rx_thread rx[THREADS] = { { 0 } };
+	struct sink_ sink = { 0 };
+	uint32_t flags = (argc > 1 && !strcmp(argv[1], "-c")) ? FFEC_CRC : 0;
+
+	NB_die_if(!(
+		mem = malloc(original_sz)
+		), "");
+	random_bytes(mem, original_sz);
+	uint64_t src_hash = fnv_hash64(NULL, mem, original_sz);
+
+	NB_die_if(!(
+		fi_enc = ffec_new(&fp, original_sz, mem, 0, 0)
+		), "");
+	fi_enc->flags = flags;
+	NB_die_if(ffec_encode(&fp, fi_enc), "");
+	NB_die_if(!(
+		fi_dec = ffec_new(&fp, original_sz, NULL, fi_enc->seeds[0], fi_enc->seeds[1])
+		), "");
+	fi_dec->flags = flags;
+	NB_die_if(ffec_ingest_init(&fp, fi_dec), "");
+	sink.src = mem;
+	NB_die_if(!(
+		sink.seen = calloc((fi_dec->cnt.k + 63) / 64, sizeof(uint64_t))
+		), "");
+	NB_die_if(ffec_sink_init(&fp, fi_dec, sink_cb, &sink), "");
+
+	/* a corrupt source symbol must be rejected without claiming its ESI */
+	if (flags & FFEC_CRC) {
+		memcpy(fi_dec->crc, fi_enc->crc, sizeof(uint32_t) * fi_enc->cnt.k);
+		NB_die_if(!(
+			bad = malloc(fp.sym_len)
+			), "");
+		memcpy(bad, mem, fp.sym_len);
+		((uint8_t *)bad)[fp.sym_len / 2] ^= 0x1;
+		struct ffec_symbol sym = { .sym = bad, .esi = 0 };
+		NB_die_if(ffec_ingest(&fp, fi_dec, sym) != -1, "corrupt symbol not caught");
+	}
+
+	for (unsigned int t=0; t < THREADS; t++) {
+		rx[t] = (struct rx_thread){
+			.id = t,
+			.fi_enc = fi_enc,
+			.fi_dec = fi_dec
+		};
+		NB_die_if(pthread_create(&rx[t].tid, NULL, rx_run, &rx[t]), "");
+	}
+
+	/* decode while receiving */
+	uint32_t left, drains = 0;
+	while ((left = ffec_ingest_drain(&fp, fi_dec))) {
+		NB_die_if(left == (uint32_t)-1, "");
+		drains++;
+		sched_yield();
+	}
+
+	uint32_t queued = 0, dropped = 0;
+	for (unsigned int t=0; t < THREADS; t++) {
+		pthread_join(rx[t].tid, NULL);
+		rx[t].tid = 0;
+		queued += rx[t].queued;
+		dropped += rx[t].dropped;
+		NB_die_if(rx[t].failed, "thread %u: %"PRIu32" symbols failed", t, rx[t].failed);
+	}
+	/* every ESI is queued once at most: the rest are dropped */
+	NB_die_if(queued > fi_dec->cnt.n, "%"PRIu32" queued > n %"PRIu32, queued, fi_dec->cnt.n);
+	NB_die_if(queued + dropped <= fi_dec->cnt.n, "no duplicates dropped");
+	NB_die_if(ffec_ingest_drain(&fp, fi_dec), "");
+
+	NB_die_if(src_hash != fnv_hash64(NULL, fi_dec->dec_source, original_sz), "");
+	NB_die_if(sink.bad || sink.cnt != fi_dec->cnt.k || sink.low != fi_dec->cnt.k,
+		"sink: %"PRIu32" bad, %"PRIu32" of %"PRIu32" symbols, watermark %"PRIu32,
+		sink.bad, sink.cnt, fi_dec->cnt.k, sink.low);
+	NB_inf("decoded with %u threads: %"PRIu32" queued, %"PRIu32" dropped, %"PRIu32" drains",
+		THREADS, queued, dropped, drains);
+
+die:
+	for (unsigned int t=0; t < THREADS; t++) {
+		if (rx[t].tid)
+			pthread_join(rx[t].tid, NULL);
+	}
+	free(bad);
+	free(sink.seen);
+	free(mem);
+	ffec_free(fi_enc);
+	ffec_free(fi_dec);
+	return err_cnt;
+}
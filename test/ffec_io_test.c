@@ -0,0 +1,231 @@
+/*	ffec_io_test.c
+
+Send a block over a local datagram socket with sendmmsg(),
+	straight from the source and parity regions (ffec_enc_mmsg()),
+	and receive it with recvmmsg():
+- into buffers, then decode each batch of received datagrams
+	in place (ffec_decode_batch()).
+- straight into the decoder's memory (ffec_rx_mmsg()),
+	with and without lost datagrams; decoded symbols go to an output sink
+	(ffec_sink_init()) as they are final.
+*/
+
+#include <ffec_io.h>
+
+#include <nonlibc.h>
+#include <nlc_urand.h>
+#include <fnv.h>
+
+#include "ffec_sink_check.h"
+
+
+#define BATCH 32
+
+static const size_t original_sz = 5000960;	/* 5MB */
+static struct ffec_params fp = {
+	.fec_ratio = 1.1,
+	.sym_len = 1280
+};
+
+
+/*	random_bytes()
+*/
+void random_bytes(void *region, size_t size)
+{
+	uint64_t seeds[2] = { 0 };
+	while (nlc_urand(seeds, sizeof(seeds)) != sizeof(seeds))
+		usleep(10000);
+	pcg_randset(region, size, seeds[0], seeds[1]);
+}
+
+
+/*	send_batch()
+Send the next (up to) 'cnt' symbols of the sequence from 'i' on,
+	except every 'loss'th one ("lost"; 0 for none).
+Returns the number of symbols of the sequence gone through.
+*/
+uint32_t send_batch(int sk, struct ffec_instance *fi_enc, uint32_t i, uint32_t cnt,
+		uint32_t loss)
+{
+	int err_cnt = 0;
+	uint32_t hdr[BATCH];
+	struct iovec iov[BATCH * FFEC_IO_IOV];
+	struct mmsghdr msgs[BATCH] = { { { 0 } } };
+
+	cnt = ffec_enc_mmsg(&fp, fi_enc, i, cnt, hdr, iov, msgs);
+	/* drop the lost ones */
+	uint32_t send = 0;
+	for (uint32_t j=0; j < cnt; j++) {
+		if (loss && !((i + j) % loss))
+			continue;
+		msgs[send++] = msgs[j];
+	}
+	if (send) {
+		int sent = sendmmsg(sk, msgs, send, 0);
+		NB_die_if(sent != (int)send, "sendmmsg %d of %"PRIu32, sent, send);
+	}
+	return cnt;
+die:
+	return 0;
+}
+
+
+/*	rx_copy()
+Receive into buffers, decode from there.
+*/
+int rx_copy(int sk[2], struct ffec_instance *fi_enc)
+{
+	int err_cnt = 0;
+	void *rx = NULL;
+	struct ffec_instance *fi_dec = NULL;
+
+	struct iovec rx_iov[BATCH];
+	struct mmsghdr rx_msgs[BATCH] = { { { 0 } } };
+	struct ffec_symbol syms[BATCH];
+
+	NB_die_if(!(
+		fi_dec = ffec_new(&fp, original_sz, NULL, fi_enc->seeds[0], fi_enc->seeds[1])
+		), "");
+
+	/* one receive buffer per datagram in a batch */
+	const size_t dgram = FFEC_IO_HDR_LEN + fp.sym_len;
+	NB_die_if(!(
+		rx = malloc(dgram * BATCH)
+		), "");
+	for (unsigned int j=0; j < BATCH; j++) {
+		rx_iov[j].iov_base = rx + (j * dgram);
+		rx_iov[j].iov_len = dgram;
+		rx_msgs[j].msg_hdr.msg_iov = &rx_iov[j];
+		rx_msgs[j].msg_hdr.msg_iovlen = 1;
+	}
+
+	uint32_t i = 0, left = fi_dec->cnt.k, batches = 0;
+	while (left) {
+		uint32_t cnt = send_batch(sk[0], fi_enc, i, BATCH, 0);
+		NB_die_if(!cnt, "sequence exhausted with %"PRIu32" symbols left", left);
+		i += cnt;
+		batches++;
+
+		int rcvd = recvmmsg(sk[1], rx_msgs, cnt, MSG_DONTWAIT, NULL);
+		NB_die_if(rcvd != (int)cnt, "recvmmsg %d of %"PRIu32, rcvd, cnt);
+
+		for (int j=0; j < rcvd; j++) {
+			syms[j] = ffec_io_sym(&fp, fi_dec,
+				rx_iov[j].iov_base, rx_msgs[j].msg_len);
+			NB_die_if(!syms[j].sym, "datagram %d: %u Bytes", j, rx_msgs[j].msg_len);
+		}
+		left = ffec_decode_batch(&fp, fi_dec, syms, rcvd);
+		NB_die_if(left == (uint32_t)-1, "");
+	}
+
+	NB_die_if(fnv_hash64(NULL, fi_enc->enc_source, original_sz)
+		!= fnv_hash64(NULL, fi_dec->dec_source, original_sz), "");
+	NB_inf("decoded from %"PRIu32" datagrams in %"PRIu32" sendmmsg() calls", i, batches);
+
+die:
+	free(rx);
+	ffec_free(fi_dec);
+	return err_cnt;
+}
+
+
+/*	rx_slots()
+Receive straight into the decoder (ffec_rx_mmsg()), losing every 'loss'th
+	datagram (0 for none).
+*/
+int rx_slots(int sk[2], struct ffec_instance *fi_enc, uint32_t loss, uint32_t flags)
+{
+	int err_cnt = 0;
+	struct ffec_instance *fi_dec = NULL;
+	struct sink_ sink = { .src = fi_enc->enc_source };
+
+	uint32_t slots[BATCH];
+	uint32_t hdr[BATCH];
+	struct iovec iov[BATCH * FFEC_IO_IOV];
+	struct mmsghdr msgs[BATCH] = { { { 0 } } };
+
+	NB_die_if(!(
+		fi_dec = ffec_new(&fp, original_sz, NULL, fi_enc->seeds[0], fi_enc->seeds[1])
+		), "");
+	fi_dec->flags = flags;
+	if (flags & FFEC_CRC)
+		memcpy(fi_dec->crc, fi_enc->crc, sizeof(uint32_t) * fi_enc->cnt.k);
+	NB_die_if(ffec_rx_init(&fp, fi_dec), "");
+	NB_die_if(!(
+		sink.seen = calloc((fi_dec->cnt.k + 63) / 64, sizeof(uint64_t))
+		), "");
+	NB_die_if(ffec_sink_init(&fp, fi_dec, sink_cb, &sink), "");
+
+	uint32_t i = 0, left = fi_dec->cnt.k;
+	while (left) {
+		uint32_t lent = ffec_rx_mmsg(&fp, fi_dec, BATCH, slots, hdr, iov, msgs);
+		/* never more than there are slots for: the rest would pile up */
+		uint32_t cnt = send_batch(sk[0], fi_enc, i, lent, loss);
+		NB_die_if(!cnt, "sequence exhausted with %"PRIu32" symbols left", left);
+		i += cnt;
+
+		int rcvd = lent ? recvmmsg(sk[1], msgs, lent, MSG_DONTWAIT, NULL) : 0;
+		if (rcvd < 0)
+			rcvd = 0;
+		left = ffec_rx_mmsg_commit(&fp, fi_dec, lent, rcvd, slots, hdr, msgs);
+		NB_die_if(left == (uint32_t)-1, "");
+	}
+
+	NB_die_if(fnv_hash64(NULL, fi_enc->enc_source, original_sz)
+		!= fnv_hash64(NULL, fi_dec->dec_source, original_sz), "");
+	NB_die_if(sink.bad || sink.cnt != fi_dec->cnt.k || sink.low != fi_dec->cnt.k,
+		"sink: %"PRIu32" bad, %"PRIu32" of %"PRIu32" symbols, watermark %"PRIu32,
+		sink.bad, sink.cnt, fi_dec->cnt.k, sink.low);
+	NB_inf("received in place from %"PRIu32" symbols, %"PRIu32" lost%s%s",
+		i, loss ? (i + loss -1) / loss : 0,
+		(flags & FFEC_DEC_DEFERRED) ? ", deferred" : "",
+		(flags & FFEC_CRC) ? ", CRC32C" : "");
+
+die:
+	/* don't leave anything in the socket for the next run */
+	while (recv(sk[1], hdr, sizeof(hdr), MSG_DONTWAIT) > 0)
+		;
+	free(sink.seen);
+	ffec_free(fi_dec);
+	return err_cnt;
+}
+
+
+/*	main()
+*/
+int main()
+{
+	int err_cnt = 0;
+	int sk[2] = { -1, -1 };
+	void *mem = NULL;
+	struct ffec_instance *fi_enc = NULL;
+
+	NB_die_if(socketpair(AF_UNIX, SOCK_DGRAM, 0, sk), "");
+	NB_die_if(!(
+		mem = malloc(original_sz)
+		), "");
+	random_bytes(mem, original_sz);
+
+	NB_die_if(!(
+		fi_enc = ffec_new(&fp, original_sz, mem, 0, 0)
+		), "");
+	fi_enc->flags = FFEC_CRC;
+	NB_die_if(ffec_encode(&fp, fi_enc), "");
+
+	NB_die_if(rx_copy(sk, fi_enc), "");
+
+	NB_die_if(rx_slots(sk, fi_enc, 0, 0), "");
+	NB_die_if(rx_slots(sk, fi_enc, 29, 0), "");
+	NB_die_if(rx_slots(sk, fi_enc, 17, FFEC_CRC), "");
+	NB_die_if(rx_slots(sk, fi_enc, 0, FFEC_DEC_DEFERRED), "");
+	NB_die_if(rx_slots(sk, fi_enc, 29, FFEC_DEC_DEFERRED | FFEC_CRC), "");
+
+die:
+	if (sk[0] != -1) {
+		close(sk[0]);
+		close(sk[1]);
+	}
+	free(mem);
+	ffec_free(fi_enc);
+	return err_cnt;
+}
@@ -0,0 +1,50 @@
+#ifndef ffec_sink_check_h_
+#define ffec_sink_check_h_
+
+/*	ffec_sink_check.h
+
+Output sink (ffec_sink_init()) callback shared by the tests:
+	checks what the decoder hands on.
+*/
+
+#include <ffec.h>
+#include <string.h> /* memcmp() */
+
+
+/*	sink_
+What the output sink (ffec_sink_init()) was told.
+*/
+struct sink_ {
+	const void	*src;	/* to compare against */
+	uint64_t	*seen;
+	uint32_t	cnt;
+	uint32_t	low;
+	uint32_t	bad;
+};
+
+
+/*	sink_cb()
+Each source symbol must come once, with the right data,
+	and the watermark only move up, past symbols already seen.
+*/
+static int sink_cb(const struct ffec_params *fp, const struct ffec_instance *fi,
+		uint32_t esi, const void *sym, uint32_t low, void *arg)
+{
+	struct sink_ *sk = arg;
+	if ((sk->seen[esi / 64] >> (esi % 64)) & 0x1)
+		sk->bad++;
+	sk->seen[esi / 64] |= 1ULL << (esi % 64);
+	if (memcmp(sym, sk->src + ((size_t)fp->sym_len * esi), fp->sym_len))
+		sk->bad++;
+	if (low < sk->low || low > fi->cnt.k)
+		sk->bad++;
+	for (; sk->low < low; sk->low++) {
+		if (!((sk->seen[sk->low / 64] >> (sk->low % 64)) & 0x1))
+			sk->bad++;
+	}
+	sk->cnt++;
+	return 0;
+}
+
+
+#endif /* ffec_sink_check_h_ */
@@ -15,6 +15,8 @@ Test performance and correctness of ffec
 
 #include <stdlib.h> /* atof() */
 
+#include "ffec_sink_check.h"
+
 
 /*	defaults:
 5MB region into 1280B symbols @ 10% FEC
@@ -22,6 +24,16 @@ Test performance and correctness of ffec
 double fec_ratio = 1.1;
 size_t original_sz = 5000960;
 size_t sym_len = 1280;
+uint32_t flags = 0;
+size_t misalign = 0;
+unsigned int threads = 1;
+int incremental = 0;
+uint32_t range = 0;
+int lazy = 0;
+uint32_t window = 0;
+uint32_t batch = 0;
+int in_order = 0;
+int sink = 0;
 
 
 /*	random_bytes()
@@ -46,14 +58,36 @@ void print_usage(char *pgm_name)
 {
 	fprintf(stderr,
 "usage:\n\
-%s	[-f <fec_ratio>] [-o <original_sz>] [-s <sym_len>] [-h]\n\
+%s	[-f <fec_ratio>] [-o <original_sz>] [-s <sym_len>] [-n] [-u] [-c] [-t <threads>] [-m <mode>] [-i] [-r <range>] [-l|-L] [-w <window>] [-b <batch>] [-d] [-e] [-S] [-k] [-h]\n\
 \n\
 fec_ratio	:	a fractional ratio >1.0 && <2.0\n\
 		default: 1.1\n\
 original_sz	:	data size in B\n\
 		default: 5000960 (5MB)\n\
-sym_len		:	size of FEC symbols, in B. Must be a multiple of 256\n\
-		default: 1280\n",
+sym_len		:	size of FEC symbols, in B. Fastest if a multiple of 64\n\
+		default: 1280\n\
+-n		:	write final symbols with non-temporal stores (FFEC_NT_STORE)\n\
+-u		:	misalign source region (forces unaligned XOR kernels)\n\
+-c		:	check each source symbol against its CRC32C (FFEC_CRC);\n\
+			then decode again with a corrupt parity symbol\n\
+threads		:	encode with ffec_encode_mt() on this many threads\n\
+		default: 1\n\
+mode		:	encode 'gather' (row-major), 'scatter' (column-major)\n\
+			or 'tiled' (column-major, by cache-sized tiles)\n\
+		default: automatic, by block size\n\
+-i		:	encode incrementally, one source symbol at a time (ffec_encode_sym())\n\
+range		:	encode incrementally, this many source symbols at a time\n\
+			(ffec_encode_range())\n\
+-l		:	encode lazily, while iterating the transmit sequence (ffec_enc_lazy())\n\
+-L		:	as -l, with parity symbols sent in ascending order (FFEC_ENC_LAZY_SORT)\n\
+window		:	keep each source symbol's rows within this many rows\n\
+			default: 0 (any rows)\n\
+batch		:	decode this many symbols at a time (ffec_decode_batch())\n\
+-d		:	decode in two phases: symbolic, then XOR (FFEC_DEC_DEFERRED)\n\
+-e		:	finish decoding by inactivation when peeling stalls (FFEC_DEC_SOLVE)\n\
+-S		:	send source symbols first, in order (a lossless link)\n\
+-k		:	write decoded output to a file as it is final (ffec_sink_fd());\n\
+			then decode again into a sink which fails once\n",
 		pgm_name);
 }
 
@@ -63,7 +97,7 @@ void parse_opts(int argc, char **argv)
 {
 	int opt;
 	extern char* optarg; /* used by getopt to point to arg values given */
-	while ((opt = getopt(argc, argv, "f:o:s:h")) != -1) {
+	while ((opt = getopt(argc, argv, "f:o:s:nuct:m:ir:lLw:b:deSkh")) != -1) {
 		switch (opt) {
 			case 'f':
 				fec_ratio = atof(optarg);
@@ -74,6 +108,60 @@ void parse_opts(int argc, char **argv)
 			case 's':
 				sym_len = atol(optarg);
 				break;
+			case 'n':
+				flags |= FFEC_NT_STORE;
+				break;
+			case 'u':
+				misalign = sizeof(uint64_t);
+				break;
+			case 'c':
+				flags |= FFEC_CRC;
+				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
+			case 'm':
+				if (!strcmp(optarg, "gather")) {
+					flags |= FFEC_ENC_GATHER;
+				} else if (!strcmp(optarg, "scatter")) {
+					flags |= FFEC_ENC_SCATTER;
+				} else if (!strcmp(optarg, "tiled")) {
+					flags |= FFEC_ENC_TILED;
+				} else {
+					print_usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'i':
+				incremental = 1;
+				break;
+			case 'r':
+				range = atol(optarg);
+				break;
+			case 'L':
+				flags |= FFEC_ENC_LAZY_SORT;
+				/* fall through */
+			case 'l':
+				lazy = 1;
+				break;
+			case 'w':
+				window = atol(optarg);
+				break;
+			case 'b':
+				batch = atol(optarg);
+				break;
+			case 'd':
+				flags |= FFEC_DEC_DEFERRED;
+				break;
+			case 'e':
+				flags |= FFEC_DEC_SOLVE;
+				break;
+			case 'S':
+				in_order = 1;
+				break;
+			case 'k':
+				sink = 1;
+				break;
 			default:
 				print_usage(argv[0]);
 				exit(1);
@@ -84,11 +172,402 @@ void parse_opts(int argc, char **argv)
 	NB_inf("fec_ratio: %f", fec_ratio);
 	NB_inf("original_sz: %zu", original_sz);
 	NB_inf("N: %d", FFEC_N1_DEGREE);
+	NB_inf("XOR kernels: %s", ffec_xor_isa());
+	NB_inf("non-temporal stores: %s", (flags & FFEC_NT_STORE) ? "yes" : "no");
+	NB_inf("CRC32C: %s", (flags & FFEC_CRC) ? "yes" : "no");
+	NB_inf("encode threads: %u", threads);
+	NB_inf("encode mode: %s", (flags & FFEC_ENC_GATHER) ? "gather"
+		: (flags & FFEC_ENC_TILED) ? "tiled"
+		: (flags & FFEC_ENC_SCATTER) ? "scatter" : "auto");
+	NB_inf("incremental encode: %s", incremental ? "yes" : "no");
+	NB_inf("range encode: %"PRIu32" symbols", range);
+	NB_inf("lazy encode: %s", lazy ? "yes" : "no");
+	NB_inf("matrix window: %"PRIu32" rows", window);
+	NB_inf("decode batch: %"PRIu32" symbols", batch);
+	NB_inf("deferred decode: %s", (flags & FFEC_DEC_DEFERRED) ? "yes" : "no");
+	NB_inf("inactivation decode: %s", (flags & FFEC_DEC_SOLVE) ? "yes" : "no");
+	NB_inf("send in order: %s", in_order ? "yes" : "no");
+	NB_inf("output sink: %s", sink ? "yes" : "no");
 	NB_inf("FFEC_RAND_PASSES: %d", FFEC_RAND_PASSES);
 }
 
 
 
+/*	crc_check()
+Give decoder the encoder's CRCs,
+	then feed it a corrupt copy of a source symbol: it must be rejected
+	(and leave no trace, which the final hash check verifies).
+*/
+int crc_check(struct ffec_params *fp,
+		struct ffec_instance *fi_enc,
+		struct ffec_instance *fi_dec)
+{
+	int err_cnt = 0;
+	void *bad = NULL;
+	memcpy(fi_dec->crc, fi_enc->crc, sizeof(uint32_t) * fi_enc->cnt.k);
+
+	struct ffec_symbol sym = { 0 };
+	for (uint32_t i=0; i < fi_enc->cnt.n; i++) {
+		sym = ffec_enc_seq(fp, fi_enc, i);
+		if (sym.esi < fi_enc->cnt.k)
+			break;
+	}
+	NB_die_if(!(
+		bad = malloc(fp->sym_len)
+		), "");
+	memcpy(bad, sym.sym, fp->sym_len);
+	((uint8_t *)bad)[fp->sym_len / 2] ^= 0x1;
+	sym.sym = bad;
+
+	NB_die_if(ffec_decode_sym(fp, fi_dec, sym) != (uint32_t)-1,
+		"corrupt esi %"PRIu32" not caught", sym.esi);
+	NB_die_if(ffec_test_esi(fi_dec, sym.esi),
+		"corrupt esi %"PRIu32" not undone", sym.esi);
+	NB_inf("corrupt esi %"PRIu32" rejected", sym.esi);
+
+die:
+	free(bad);
+	return err_cnt;
+}
+
+
+/*	encode_incremental()
+Feed source symbols to the encoder one at a time, as if being produced,
+	checking the count of symbols still missing;
+	give one symbol twice, which must be ignored.
+*/
+int encode_incremental(struct ffec_params *fp,
+			struct ffec_instance *fi,
+			const void *src)
+{
+	int err_cnt = 0;
+	for (uint32_t i=0; i < fi->cnt.k; i++) {
+		struct ffec_symbol sym = {
+			.sym = src + ((size_t)fp->sym_len * i),
+			.esi = i
+		};
+		NB_die_if(ffec_encode_sym(fp, fi, sym) != fi->cnt.k - i -1,
+			"esi %"PRIu32, i);
+		if (i == fi->cnt.k / 2) {
+			NB_die_if(ffec_encode_sym(fp, fi, sym) != fi->cnt.k - i -1,
+				"esi %"PRIu32" given twice", i);
+		}
+	}
+die:
+	return err_cnt;
+}
+
+
+/*	encode_range()
+Encode 'range' source symbols at a time:
+	parity reported final must be monotonic, and complete at the end;
+	that reported final halfway through must not change afterwards.
+An empty range first: it must release nothing.
+*/
+int encode_range(struct ffec_params *fp,
+		struct ffec_instance *fi)
+{
+	int err_cnt = 0;
+	void *early = NULL;
+	size_t early_len = 0;
+	uint32_t released = ffec_encode_range(fp, fi, 0, 0);
+	NB_die_if(released, "empty range: %"PRIu32" parity symbols final", released);
+
+	for (uint32_t i=0; i < fi->cnt.k; i += range) {
+		uint32_t last = (fi->cnt.k - i > range) ? i + range : fi->cnt.k;
+		uint32_t ret = ffec_encode_range(fp, fi, i, last);
+		NB_die_if(ret == (uint32_t)-1 || ret < released, "range %"PRIu32"-%"PRIu32, i, last);
+		released = ret;
+
+		if (!early && last >= fi->cnt.k / 2) {
+			NB_inf("%"PRIu32" of %"PRIu32" parity symbols final at source symbol %"PRIu32,
+				released, fi->cnt.p, last);
+			early_len = (size_t)fp->sym_len * released;
+			NB_die_if(!(
+				early = malloc(early_len +1)
+				), "");
+			memcpy(early, fi->parity, early_len);
+		}
+	}
+	NB_die_if(released != fi->cnt.p, "%"PRIu32" != %"PRIu32, released, fi->cnt.p);
+	NB_die_if(memcmp(early, fi->parity, early_len), "released parity changed");
+
+die:
+	free(early);
+	return err_cnt;
+}
+
+
+/*	encode_lazy()
+"Transmit" the whole sequence, encoding lazily:
+	each parity symbol must be ready when asked for;
+	in ascending order, no parity may be computed before it is asked for.
+*/
+int encode_lazy(struct ffec_params *fp,
+		struct ffec_instance *fi)
+{
+	int err_cnt = 0;
+	for (uint32_t i=0; i < fi->cnt.n; i++) {
+		struct ffec_symbol sym = ffec_enc_lazy(fp, fi, i);
+		NB_die_if(!sym.sym, "symbol %"PRIu32, i);
+		NB_die_if(sym.esi >= fi->cnt.k && sym.esi - fi->cnt.k >= fi->cnt.p_encoded,
+			"esi %"PRIu32" not computed", sym.esi);
+		NB_die_if((fi->flags & FFEC_ENC_LAZY_SORT) && sym.esi >= fi->cnt.k
+				&& sym.esi - fi->cnt.k +1 != fi->cnt.p_encoded,
+			"esi %"PRIu32": %"PRIu32" parity computed",
+			sym.esi, fi->cnt.p_encoded);
+	}
+	NB_die_if(fi->cnt.p_encoded != fi->cnt.p, "");
+die:
+	return err_cnt;
+}
+
+
+/*	send_seq()
+Symbol 'i' of the transmit sequence: that of the encoder,
+	or all source symbols in order and then parity (see 'in_order').
+*/
+struct ffec_symbol send_seq(struct ffec_params *fp,
+			struct ffec_instance *fi_enc,
+			uint32_t i)
+{
+	if (!in_order)
+		return ffec_enc_seq(fp, fi_enc, i);
+	struct ffec_symbol ret = { .esi = i };
+	if (i < fi_enc->cnt.k)
+		ret.sym = fi_enc->enc_source + ((size_t)fp->sym_len * i);
+	else
+		ret.sym = fi_enc->parity + ((size_t)fp->sym_len * (i - fi_enc->cnt.k));
+	return ret;
+}
+
+
+/*	sink_check()
+What the decoder wrote out (ffec_sink_fd()) must be the source region,
+	all of it.
+*/
+int sink_check(struct ffec_instance *fi_dec, FILE *out, uint64_t src_hash)
+{
+	int err_cnt = 0;
+	void *back = NULL;
+	NB_die_if(ffec_sink_low(fi_dec) != fi_dec->cnt.k,
+		"watermark %"PRIu32" != k %"PRIu32, ffec_sink_low(fi_dec), fi_dec->cnt.k);
+	NB_die_if(!(
+		back = malloc(original_sz)
+		), "");
+	rewind(out);
+	NB_die_if(fread(back, 1, original_sz, out) != original_sz, "");
+	NB_die_if(src_hash != fnv_hash64(NULL, back, original_sz), "");
+die:
+	free(back);
+	return err_cnt;
+}
+
+
+/*	sink_fail_
+Output sink (ffec_sink_init()) whose callback fails for one ESI.
+*/
+struct sink_fail_ {
+	struct sink_	chk;
+	uint32_t	esi;	/* fail for this one: none if >= k */
+	uint32_t	failed;
+	int		mark;	/* set before each decode call */
+	uint32_t	first;	/* first ESI made final by the last call which made any */
+};
+
+
+/*	sink_fail_cb()
+*/
+int sink_fail_cb(const struct ffec_params *fp, const struct ffec_instance *fi,
+		uint32_t esi, const void *sym, uint32_t low, void *arg)
+{
+	struct sink_fail_ *sf = arg;
+	sink_cb(fp, fi, esi, sym, low, &sf->chk);
+	if (sf->mark) {
+		sf->first = esi;
+		sf->mark = 0;
+	}
+	if (esi != sf->esi)
+		return 0;
+	sf->failed++;
+	return -1;
+}
+
+
+/*	sink_fail_run()
+Decode the whole sequence with a new instance, into a failing sink:
+	exactly those decode calls in which the callback fails must return -1,
+	and decoding must complete all the same.
+*/
+int sink_fail_run(struct ffec_params *fp,
+		struct ffec_instance *fi_enc,
+		uint64_t src_hash,
+		struct sink_fail_ *sf)
+{
+	int err_cnt = 0;
+	struct ffec_instance *fi_dec = NULL;
+	NB_die_if(!(
+		fi_dec = ffec_new(fp, original_sz, NULL, fi_enc->seeds[0], fi_enc->seeds[1])
+		), "");
+	fi_dec->flags = flags;
+	if (flags & FFEC_CRC)
+		memcpy(fi_dec->crc, fi_enc->crc, sizeof(uint32_t) * fi_enc->cnt.k);
+	NB_die_if(!(
+		sf->chk.seen = calloc((fi_dec->cnt.k + 63) / 64, sizeof(uint64_t))
+		), "");
+	NB_die_if(ffec_sink_init(fp, fi_dec, sink_fail_cb, sf), "");
+
+	for (uint32_t i=0; i < fi_dec->cnt.n && fi_dec->cnt.k_decoded < fi_dec->cnt.k; i++) {
+		uint32_t failed = sf->failed;
+		sf->mark = 1;
+		uint32_t ret = ffec_decode_sym(fp, fi_dec, send_seq(fp, fi_enc, i));
+		NB_die_if((ret == (uint32_t)-1) != (sf->failed != failed),
+			"symbol %"PRIu32": returned %"PRIu32", %"PRIu32" sink failures",
+			i, ret, sf->failed - failed);
+	}
+	NB_die_if(fi_dec->cnt.k_decoded != fi_dec->cnt.k,
+		"%"PRIu32" of %"PRIu32" decoded", fi_dec->cnt.k_decoded, fi_dec->cnt.k);
+	NB_die_if(src_hash != fnv_hash64(NULL, fi_dec->dec_source, original_sz), "");
+	NB_die_if(sf->chk.bad || sf->chk.cnt != fi_dec->cnt.k || sf->chk.low != fi_dec->cnt.k
+			|| ffec_sink_low(fi_dec) != fi_dec->cnt.k,
+		"sink: %"PRIu32" bad, %"PRIu32" of %"PRIu32" symbols, watermark %"PRIu32,
+		sf->chk.bad, sf->chk.cnt, fi_dec->cnt.k, ffec_sink_low(fi_dec));
+
+die:
+	free(sf->chk.seen);
+	sf->chk.seen = NULL;
+	ffec_free(fi_dec);
+	return err_cnt;
+}
+
+
+/*	sink_fail()
+A sink callback which fails must make its decode call return -1,
+	and leave decoding undisturbed.
+Fail the first symbol made final by the call which completes decoding:
+	with FFEC_DEC_SOLVE, that call goes on to feed symbols
+	back through ffec_decode_sym().
+*/
+int sink_fail(struct ffec_params *fp,
+		struct ffec_instance *fi_enc,
+		uint64_t src_hash)
+{
+	int err_cnt = 0;
+	struct sink_fail_ sf = { .chk.src = fi_enc->enc_source, .esi = fi_enc->cnt.k };
+	NB_die_if(sink_fail_run(fp, fi_enc, src_hash, &sf), "no failure");
+
+	sf = (struct sink_fail_){ .chk.src = fi_enc->enc_source, .esi = sf.first };
+	NB_die_if(sink_fail_run(fp, fi_enc, src_hash, &sf), "failure on esi %"PRIu32, sf.esi);
+	NB_die_if(sf.failed != 1, "%"PRIu32" sink failures", sf.failed);
+	NB_inf("sink failure on esi %"PRIu32" reported", sf.esi);
+die:
+	return err_cnt;
+}
+
+
+/*	crc_check_parity()
+Decode the whole sequence with a new instance, the first parity symbol corrupt:
+	source symbols recovered through it fail their CRC,
+	and each decode call which hands one on (see sink_cb()) must return -1.
+*/
+int crc_check_parity(struct ffec_params *fp,
+			struct ffec_instance *fi_enc)
+{
+	int err_cnt = 0;
+	void *parity = NULL;
+	struct ffec_symbol *syms = NULL;
+	struct ffec_instance *fi_dec = NULL;
+	struct sink_ chk = { .src = fi_enc->enc_source };
+	const uint32_t cnt = batch ? batch : 1;
+	uint32_t failed = 0;
+
+	const size_t parity_len = (size_t)fp->sym_len * fi_enc->cnt.p;
+	NB_die_if(!(
+		parity = malloc(parity_len)
+		), "");
+	memcpy(parity, fi_enc->parity, parity_len);
+	uint32_t bad_esi = fi_enc->cnt.k;
+	for (uint32_t i=0; i < fi_enc->cnt.n; i++) {
+		bad_esi = send_seq(fp, fi_enc, i).esi;
+		if (bad_esi >= fi_enc->cnt.k)
+			break;
+	}
+	((uint8_t *)parity)[((size_t)fp->sym_len * (bad_esi - fi_enc->cnt.k))
+				+ fp->sym_len / 2] ^= 0x1;
+	NB_die_if(!(
+		syms = malloc(sizeof(*syms) * cnt)
+		), "");
+
+	NB_die_if(!(
+		fi_dec = ffec_new(fp, original_sz, NULL, fi_enc->seeds[0], fi_enc->seeds[1])
+		), "");
+	fi_dec->flags = flags;
+	memcpy(fi_dec->crc, fi_enc->crc, sizeof(uint32_t) * fi_enc->cnt.k);
+	NB_die_if(!(
+		chk.seen = calloc((fi_dec->cnt.k + 63) / 64, sizeof(uint64_t))
+		), "");
+	NB_die_if(ffec_sink_init(fp, fi_dec, sink_cb, &chk), "");
+
+	for (uint32_t i=0; i < fi_dec->cnt.n && fi_dec->cnt.k_decoded < fi_dec->cnt.k; ) {
+		uint32_t j = 0;
+		for (; j < cnt && i < fi_dec->cnt.n; j++, i++) {
+			syms[j] = send_seq(fp, fi_enc, i);
+			if (syms[j].esi >= fi_dec->cnt.k)
+				syms[j].sym = parity
+					+ ((size_t)fp->sym_len * (syms[j].esi - fi_dec->cnt.k));
+		}
+		uint32_t bad = chk.bad;
+		uint32_t ret = batch ? ffec_decode_batch(fp, fi_dec, syms, j)
+				: ffec_decode_sym(fp, fi_dec, syms[0]);
+		NB_die_if(chk.bad != bad && ret != (uint32_t)-1,
+			"symbol %"PRIu32": %"PRIu32" corrupt symbols final, returned %"PRIu32,
+			i, chk.bad - bad, ret);
+		failed += (ret == (uint32_t)-1);
+	}
+	NB_die_if(!chk.bad, "no corrupt symbol recovered");
+	NB_inf("corrupt parity: %"PRIu32" bad source symbols reported by %"PRIu32" calls",
+		chk.bad, failed);
+
+die:
+	free(parity);
+	free(syms);
+	free(chk.seen);
+	ffec_free(fi_dec);
+	return err_cnt;
+}
+
+
+/*	decode_batch()
+Decode 'batch' symbols of the sequence at a time,
+	as if handed over by recvmmsg().
+Sets 'i' to the number of symbols given to the decoder:
+	the whole of the last batch is counted.
+*/
+int decode_batch(struct ffec_params *fp,
+		struct ffec_instance *fi_enc,
+		struct ffec_instance *fi_dec,
+		uint32_t *i)
+{
+	int err_cnt = 0;
+	struct ffec_symbol *syms = NULL;
+	NB_die_if(!(
+		syms = malloc(sizeof(*syms) * batch)
+		), "");
+
+	uint32_t left = fi_dec->cnt.k;
+	for (*i = 0; *i < fi_dec->cnt.n && left; ) {
+		uint32_t cnt = 0;
+		for (; cnt < batch && *i < fi_dec->cnt.n; cnt++, (*i)++)
+			syms[cnt] = send_seq(fp, fi_enc, *i);
+		left = ffec_decode_batch(fp, fi_dec, syms, cnt);
+		NB_die_if(left == (uint32_t)-1, "batch ending %"PRIu32, *i);
+	}
+die:
+	free(syms);
+	return err_cnt;
+}
+
+
 /*	main()
 */
 int main(int argc, char **argv)
@@ -99,20 +578,22 @@ int main(int argc, char **argv)
 	parse_opts(argc, argv);
 	struct ffec_params fp = {
 		.fec_ratio = fec_ratio,	/* 1.1 == 10% FEC */
-		.sym_len = sym_len	/* aka: packet size */
+		.sym_len = sym_len,	/* aka: packet size */
+		.window = window
 	};
 
 	int err_cnt = 0;
-	void *mem = NULL;
+	void *buf = NULL, *mem = NULL;
 	struct ffec_instance *fi_enc = NULL, *fi_dec = NULL;
+	FILE *out = NULL;
 
 
 	/*
 		set up source memory region
 	*/
-	NB_die_if(!(
-		mem = malloc(original_sz)
-		), "");
+	NB_die_if(posix_memalign(&buf, FFEC_MEM_ALIGN, original_sz + misalign),
+		"alloc %zu", original_sz + misalign);
+	mem = buf + misalign;
 	random_bytes(mem, original_sz);
 	/* get a hash of the source */
 	uint64_t src_hash = fnv_hash64(NULL, mem, original_sz);
@@ -125,9 +606,19 @@ int main(int argc, char **argv)
 		NB_die_if(!(
 			fi_enc = ffec_new(&fp, original_sz, mem, 0, 0)
 			), "");
-		ffec_encode(&fp, fi_enc);
+		fi_enc->flags = flags;
+		if (incremental) {
+			NB_die_if(encode_incremental(&fp, fi_enc, mem), "");
+		} else if (range) {
+			NB_die_if(encode_range(&fp, fi_enc), "");
+		} else if (lazy) {
+			NB_die_if(encode_lazy(&fp, fi_enc), "");
+		} else {
+			NB_die_if(ffec_encode_mt(&fp, fi_enc, threads), "");
+		}
 	nlc_timing_stop(clock_enc);
 	NB_inf("encode ELAPSED: %.2lfms", nlc_timing_wall(clock_enc) * 1000);
+	NB_inf("aligned XOR kernels: %s", fi_enc->aligned ? "yes" : "no");
 
 	/* invariant: encode must NOT alter the source region */
 	NB_die_if(src_hash != fnv_hash64(NULL, mem, original_sz), "");
@@ -143,6 +634,15 @@ int main(int argc, char **argv)
 						fi_enc->seeds[0],
 						fi_enc->seeds[1])
 			), "");
+		fi_dec->flags = flags;
+		if (sink) {
+			NB_die_if(!(
+				out = tmpfile()
+				), "");
+			NB_die_if(ffec_sink_fd(&fp, fi_dec, fileno(out)), "");
+		}
+		if (flags & FFEC_CRC)
+			NB_die_if(crc_check(&fp, fi_enc, fi_dec), "");
 #ifdef DEBUG
 		NB_die_if(ffec_mtx_cmp(fi_enc, fi_dec, &fp), "");
 #endif
@@ -151,9 +651,13 @@ int main(int argc, char **argv)
 		Break when decoder reports 0 symbols left to decode.
 		*/
 		uint32_t i=0;
-		for (; i < fi_dec->cnt.n; i++)
-			if (!ffec_decode_sym(&fp, fi_dec, ffec_enc_seq(&fp, fi_enc, i)))
-				break;
+		if (batch) {
+			NB_die_if(decode_batch(&fp, fi_enc, fi_dec, &i), "");
+		} else {
+			for (; i < fi_dec->cnt.n; i++)
+				if (!ffec_decode_sym(&fp, fi_dec, send_seq(&fp, fi_enc, i)))
+					break;
+		}
 	nlc_timing_stop(clock_dec);
 
 	/*
@@ -161,12 +665,23 @@ int main(int argc, char **argv)
 	decoded region must be bit-identical to source
 	*/
 	NB_die_if(src_hash != fnv_hash64(NULL, fi_dec->dec_source, original_sz), "");
+	if (sink) {
+		NB_die_if(sink_check(fi_dec, out, src_hash), "");
+		NB_die_if(sink_fail(&fp, fi_enc, src_hash), "");
+	}
+	/* a lossless link needs no parity */
+	if ((flags & FFEC_CRC) && !in_order)
+		NB_die_if(crc_check_parity(&fp, fi_enc), "");
 
 
 	/*
 		report
 	*/
 	NB_inf("decode ELAPSED: %.2lfms", nlc_timing_wall(clock_dec) * 1000);
+	NB_inf("decode memory: %.2lf MiB (source %.2lf MiB)",
+		(double)(fi_dec->source_len + fi_dec->parity_len + fi_dec->scratch_len)
+			/ (1024 * 1024),
+		(double)fi_dec->source_len / (1024 * 1024));
 	NB_inf("decoded with k=%"PRIu32" < i=%"PRIu32" < n=%"PRIu32";\n\
 \tinefficiency=%lf; channel loss tolerance=%.2lf%%; FEC=%.2lf%%\n\
 \tsource size=%.4lf MiB, bitrates: enc=%"PRIu64"Mb/s, dec=%"PRIu64"Mb/s",
@@ -183,8 +698,10 @@ int main(int argc, char **argv)
 			/ (1024 * 1024) * 8));
 
 die:
-	free(mem);
+	free(buf);
 	ffec_free(fi_enc);
 	ffec_free(fi_dec);
+	if (out)
+		fclose(out);
 	return err_cnt;
 }
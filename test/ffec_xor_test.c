@@ -0,0 +1,178 @@
+/*	ffec_xor_test.c
+
+Verify the XOR kernels of every supported instruction set
+	against a naive byte-wise reference.
+*/
+
+#include <ffec.h>
+
+#include <nonlibc.h>
+#include <nlc_urand.h>
+
+
+#define MAX_LEN 2048
+#define MAX_SRC 19
+
+static const char *isas[] = { "scalar", "sse2", "avx2", "avx512" };
+/* whole stripes, single vectors, words and Bytes */
+static const uint32_t lens[] = { MAX_LEN, 1472, 1000, 1001, 72, 7 };
+static uint32_t sym_len;
+
+
+/*	random_bytes()
+*/
+void random_bytes(void *region, size_t size)
+{
+	uint64_t seeds[2] = { 0 };
+	while (nlc_urand(seeds, sizeof(seeds)) != sizeof(seeds))
+		usleep(10000);
+	pcg_randset(region, size, seeds[0], seeds[1]);
+}
+
+
+/*	test_gather()
+*/
+int test_gather(uint8_t *src, uint8_t *ref, uint8_t *out)
+{
+	int err_cnt = 0;
+	const void *from[MAX_SRC +1];
+	for (unsigned int i=0; i < MAX_SRC; i++)
+		from[i] = src + (i * sym_len);
+
+	for (uint32_t cnt=0; cnt <= MAX_SRC; cnt++) {
+		/* reference */
+		memset(ref, 0x0, sym_len);
+		for (uint32_t i=0; i < cnt; i++)
+			for (uint32_t b=0; b < sym_len; b++)
+				ref[b] ^= src[i * sym_len + b];
+
+		/* overwrite */
+		memset(out, 0xff, sym_len);
+		ffec_xor_gather(from, cnt, out, sym_len);
+		NB_err_if(memcmp(ref, out, sym_len),
+			"%s: gather of %"PRIu32" (len %"PRIu32") mismatch",
+			ffec_xor_isa(), cnt, sym_len);
+
+		/* accumulate: 'out' is also a source */
+		random_bytes(out, sym_len);
+		for (uint32_t b=0; b < sym_len; b++)
+			ref[b] ^= out[b];
+		from[cnt] = out;
+		ffec_xor_gather(from, cnt +1, out, sym_len);
+		NB_err_if(memcmp(ref, out, sym_len),
+			"%s: accumulating gather of %"PRIu32" mismatch", ffec_xor_isa(), cnt);
+		from[cnt] = src + (cnt * sym_len);
+	}
+
+	return err_cnt;
+}
+
+
+/*	test_scatter()
+'src' holds MAX_SRC symbols: scatter the first into (some of) the others.
+'ref' must have space for MAX_SRC symbols.
+*/
+int test_scatter(uint8_t *src, uint8_t *ref)
+{
+	int err_cnt = 0;
+	void *to[MAX_SRC];
+
+	for (uint32_t cnt=0; cnt < MAX_SRC; cnt++) {
+		/* reference */
+		memcpy(ref, src, sym_len * MAX_SRC);
+		for (uint32_t i=1; i <= cnt; i++) {
+			to[i-1] = src + (i * sym_len);
+			for (uint32_t b=0; b < sym_len; b++)
+				ref[i * sym_len + b] ^= src[b];
+		}
+
+		ffec_xor_scatter(src, to, cnt, sym_len);
+		NB_err_if(memcmp(ref, src, sym_len * MAX_SRC),
+			"%s: scatter to %"PRIu32" mismatch", ffec_xor_isa(), cnt);
+	}
+
+	/* copy and scatter: to the last symbol, from the first */
+	memcpy(ref, src, sym_len * MAX_SRC);
+	memcpy(ref + (MAX_SRC -1) * sym_len, src, sym_len);
+	for (uint32_t i=1; i < MAX_SRC -1; i++) {
+		to[i-1] = src + (i * sym_len);
+		for (uint32_t b=0; b < sym_len; b++)
+			ref[i * sym_len + b] ^= src[b];
+	}
+	ffec_xor_copy_scatter(src, src + (MAX_SRC -1) * sym_len, to, MAX_SRC -2, sym_len);
+	NB_err_if(memcmp(ref, src, sym_len * MAX_SRC),
+		"%s: copy-scatter mismatch", ffec_xor_isa());
+
+	/* a duplicate destination is XORed twice: cancels out */
+	memcpy(ref, src, sym_len * 2);
+	to[0] = to[1] = src + sym_len;
+	ffec_xor_scatter(src, to, 2, sym_len);
+	NB_err_if(memcmp(ref, src, sym_len * 2),
+		"%s: scatter to duplicate mismatch", ffec_xor_isa());
+
+	return err_cnt;
+}
+
+
+/*	test_crc()
+CRC32C against the standard check value and a bit-wise reference.
+*/
+int test_crc(uint8_t *src)
+{
+	int err_cnt = 0;
+	NB_err_if(ffec_crc32c("123456789", 9) != 0xe3069283,
+		"%s: CRC32C check value mismatch", ffec_xor_isa());
+
+	uint32_t ref = ~0U;
+	for (uint32_t b=0; b < sym_len; b++) {
+		ref ^= src[b];
+		for (unsigned int j=0; j < 8; j++)
+			ref = (ref >> 1) ^ ((ref & 1) ? 0x82f63b78 : 0);
+	}
+	NB_err_if(ffec_crc32c(src, sym_len) != ~ref,
+		"%s: CRC32C (len %"PRIu32") mismatch", ffec_xor_isa(), sym_len);
+
+	return err_cnt;
+}
+
+
+/*	main()
+*/
+int main()
+{
+	int err_cnt = 0;
+	uint8_t *src = NULL, *ref = NULL, *out = NULL;
+
+	NB_die_if(!(
+		src = malloc(MAX_LEN * MAX_SRC)
+		), "");
+	NB_die_if(!(
+		ref = malloc(MAX_LEN * MAX_SRC)
+		), "");
+	NB_die_if(!(
+		out = malloc(MAX_LEN)
+		), "");
+	random_bytes(src, MAX_LEN * MAX_SRC);
+
+	for (unsigned int i=0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+		if (ffec_xor_bind(isas[i])) {
+			NB_inf("%s: not supported, skipping", isas[i]);
+			continue;
+		}
+		int fails = 0;
+		for (unsigned int j=0; j < sizeof(lens) / sizeof(lens[0]); j++) {
+			sym_len = lens[j];
+			fails += test_gather(src, ref, out)
+				+ test_scatter(src, ref)
+				+ test_crc(src);
+		}
+		NB_inf("%s: %s", isas[i], fails ? "FAIL" : "OK");
+		err_cnt += fails;
+	}
+
+die:
+	free(src);
+	free(ref);
+	free(out);
+	return err_cnt;
+}